@@ -0,0 +1,80 @@
+#ifndef _ARENA_
+#define _ARENA_
+
+#include <cstddef>
+#include <cstdlib>
+
+/** Single block bump allocator. Sizes are reserved first, then handed out in the same order.
+ *  Storage is uninitialised and meant for plain data; everything is released at once. A reset
+ *  arena keeps its block and commits into it again when the next layout fits. */
+
+class Arena {
+
+	public:
+
+		Arena() : m_data(0), m_size(0), m_used(0), m_capacity(0) {}
+		~Arena() { free (m_data); }
+
+		template<class T> void reserve (size_t count)	{ m_size = round (m_size) + count * sizeof (T); }
+
+		bool commit() {											/** Allocate everything reserved so far */
+
+			if (!m_data || m_size > m_capacity) {
+
+				free (m_data);
+				m_data     = (char*) malloc (m_size? m_size: 1);
+				m_capacity = m_data? m_size: 0;
+			}
+
+			m_used = 0;
+			return m_data != 0;
+		}
+
+		template<class T> T* allocate (size_t count) {			/** Next reserved range */
+
+			m_used = round (m_used);
+			T* p   = (T*) (m_data + m_used);
+			m_used += count * sizeof (T);
+			return p;
+		}
+
+		void clear() {
+
+			free (m_data);
+			m_data = 0;
+			m_size = m_used = m_capacity = 0;
+		}
+
+		void reset (size_t keep) {								/** Forget the layout, keeping a block of up to keep bytes */
+
+			if (m_capacity > keep) clear();
+
+			m_size = m_used = 0;
+		}
+
+		void swap (Arena& other) {
+
+			char*  data = m_data; m_data = other.m_data; other.m_data = data;
+			size_t size = m_size; m_size = other.m_size; other.m_size = size;
+			size_t used = m_used; m_used = other.m_used; other.m_used = used;
+			size_t cap  = m_capacity; m_capacity = other.m_capacity; other.m_capacity = cap;
+		}
+
+		size_t size() const		{ return m_data? m_size: 0; }			/** Bytes laid out */
+		size_t capacity() const	{ return m_capacity; }				/** Bytes held */
+		const char* data() const	{ return m_data; }
+
+	private:
+
+		Arena (const Arena&);									// Not copyable
+		Arena& operator= (const Arena&);
+
+		static size_t round (size_t v) { return (v + 15) & ~(size_t) 15; }
+
+		char*  m_data;
+		size_t m_size;
+		size_t m_used;
+		size_t m_capacity;										// Of the block, at least m_size once committed
+};
+
+#endif
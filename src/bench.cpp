@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+#include "bench.h"
+#include "bvh.h"
+#include "bvh_parse.h"
+#include "mappedfile.h"
+#include "thread.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds (Clock::time_point start) {
+
+	return std::chrono::duration<double> (Clock::now() - start).count();
+}
+
+static std::string syntheticBVH (int frames) {				// 1 root + 59 joints, typical mocap precision
+
+	const int joints = 60;
+	std::string s;
+	char buffer[256];
+
+	s += "HIERARCHY\nROOT Hips\n{\n\tOFFSET 0 0 0\n\tCHANNELS 6 Xposition Yposition Zposition Zrotation Xrotation Yrotation\n";
+
+	for (int i=1; i<joints; ++i) {
+
+		snprintf (buffer, sizeof (buffer), "JOINT j%d\n{\n\tOFFSET 0 %d.5 0\n\tCHANNELS 3 Zrotation Xrotation Yrotation\n", i, i%7);
+		s += buffer;
+	}
+
+	s += "End Site\n{\n\tOFFSET 0 1 0\n}\n";
+	for (int i=0; i<joints; ++i) s += "}\n";
+
+	snprintf (buffer, sizeof (buffer), "MOTION\nFrames:\t%d\nFrame Time:\t0.008333\n", frames);
+	s += buffer;
+
+	unsigned seed = 1;
+
+	for (int f=0; f<frames; ++f) {
+
+		for (int i=0; i<joints*3+3; ++i) {
+
+			seed = seed * 1103515245 + 12345;
+			snprintf (buffer, sizeof (buffer), "%.6f ", ((int)(seed >> 8) % 36000000) * 1e-5 - 180);
+			s += buffer;
+		}
+
+		s += "\n";
+	}
+
+	return s;
+}
+
+static const char* motionBlock (const char* data, const char* end) {	// First frame line, or end
+
+	const char* s = data;
+
+	while (s<end && !word (s, end, "MOTION", 6)) nextLine (s, end);
+
+	for (int i=0; i<3; ++i) nextLine (s, end);				// Skip MOTION, Frames: and Frame Time:
+	return s;
+}
+
+static void benchmark (const char* label, const char* data, size_t size) {
+
+	const double mb     = size / (1024.0 * 1024.0);
+	const char*  end    = data + size;
+	const char*  motion = motionBlock (data, end);
+	const int    cores  = base::Thread::cores();
+	double best[4]      = { 1e9, 1e9, 1e9, 1e9 };
+	float  sum          = 0;
+
+	for (int run=0; run<3; ++run) {
+
+		Clock::time_point t = Clock::now();					// Tokenizer only
+		float value;
+
+		for (const char* s = motion; readFloat (s, end, value); ) sum += value;
+
+		double d = seconds (t);
+		if (d < best[0]) best[0] = d;
+
+		std::string copy (motion, end);						// strtod reference needs a terminator
+		const char* s = copy.c_str();
+		char* stop;
+
+		t = Clock::now();
+
+		for (;;) {
+
+			value = strtod (s, &stop);
+			if (stop == s) break;
+			sum += value;
+			s = stop;
+		}
+
+		d = seconds (t);
+		if (d < best[1]) best[1] = d;
+
+		t = Clock::now();									// Full load
+		BVH* bvh = new BVH();
+		bool ok  = bvh->load (data, size);
+		d        = seconds (t);
+		delete bvh;
+
+		if (!ok) { printf ("%s: failed to load\n", label); return; }
+		if (d < best[2]) best[2] = d;
+
+		t   = Clock::now();									// Full load, all cores
+		bvh = new BVH();
+		bvh->load (data, size, cores);
+		d   = seconds (t);
+		delete bvh;
+
+		if (d < best[3]) best[3] = d;
+	}
+
+	const double motionMB = (end - motion) / (1024.0 * 1024.0);
+
+	printf ("%s (%.1f MB)\n", label, mb);
+	printf ("  readFloat  %8.1f MB/s\n", motionMB / best[0]);
+	printf ("  strtod     %8.1f MB/s\n", motionMB / best[1]);
+	printf ("  BVH::load  %8.1f MB/s  %.3f s\n", mb / best[2], best[2]);
+	printf ("  x%-2d cores  %8.1f MB/s  %.3f s\n", cores, mb / best[3], best[3]);
+
+	if (sum == 12345.f) printf ("\n");						// Keep the loops alive
+}
+
+int runBenchmark (int argc, char* argv[]) {
+
+	int frames = 20000;
+	int first  = 0;
+
+	if (argc > 0 && atoi (argv[0]) > 0) { frames = atoi (argv[0]); first = 1; }
+
+	#ifdef BVH_SIMD_DIGITS
+	printf ("Digit scanning: SSE2\n");
+	#else
+	printf ("Digit scanning: scalar\n");
+	#endif
+
+	std::string synthetic = syntheticBVH (frames);
+	char label[64];
+
+	snprintf (label, sizeof (label), "synthetic %d frames", frames);
+	benchmark (label, synthetic.c_str(), synthetic.size());
+
+	for (int i=first; i<argc; ++i) {
+
+		MappedFile file;
+
+		if (file.open (argv[i])) benchmark (argv[i], file.data(), file.size());
+		else printf ("%s: failed to open\n", argv[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef _BENCH_
+#define _BENCH_
+
+/** Parser throughput benchmark: bvh-browser --bench [frames] [file.bvh ...]
+ *  Reports MB/s for the float tokenizer alone, strtod for reference, and a full BVH::load
+ *  on one and on all cores, for a synthetic clip of the given length plus any files listed. */
+
+int runBenchmark (int argc, char* argv[]);
+
+#endif
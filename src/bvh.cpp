@@ -1,298 +1,823 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <algorithm>
 
 #include "bvh.h"
+#include "bvh_parse.h"
+#include "thread.h"
+#include "mappedfile.h"
 
-BVH::BVH() : m_root(0), m_parts(0), m_partCount(0) {}
+static bool hasPosition (int channels) {
+    
+	for (; channels; channels >>= 3) if ((channels & 0x7) <= BVH::Zpos) return true;
+    
+	return false;
+}
 
-BVH::~BVH() {
+static int rotationOrder (int channels) {
     
-	for (int i=0; i<m_partCount; ++i) {
+	static const int orders[3][3] = { { -1, BVH_Math::XYZ, BVH_Math::XZY },     // [first][second] axis
+	                                  { BVH_Math::YXZ, -1, BVH_Math::YZX },
+	                                  { BVH_Math::ZXY, BVH_Math::ZYX, -1 } };
+    
+	int axes[3], count = 0, seen = 0;
+    
+	for (; channels; channels >>= 3) {
         
-		delete [] m_parts[i]->name;
-		delete [] m_parts[i]->motion;
+		int axis = (channels & 0x7) - BVH::Xrot;
         
-        m_parts[i]->childIndices = std::vector<int>();  // Release memory by replacing with an empty vectpr (https://stackoverflow.com/a/63196454)
+		if (axis < 0) continue;
+		if (count == 3 || seen & (1 << axis)) return -1;
         
-		delete m_parts[i];
+		axes[count++] = axis;
+		seen         |= 1 << axis;
 	}
     
-	delete [] m_parts;
-}
-
-inline void whitespace (const char*& s) {
-    
-	while (*s==' ' || *s=='\t' || *s=='\n' || *s=='\r') ++s;
+	return count == 3? orders[axes[0]][axes[1]]: -1;
 }
 
-inline void nextLine (const char*& s) {
+/* MOTION is decoded in two stages. Frame lines are first tokenized into a matrix of values, one
+ * column of batch frames per channel, with no knowledge of what the channels mean. Each part then
+ * turns its columns into tracks through a decoder instantiated for its CHANNELS layout. */
 
-    while (*s && *s != '\n' && *s != '\r') ++s;
-	whitespace (s);
-}
+static const float toRad = 3.141592653592f / 180;
 
-inline bool word (const char*& s, const char* key, int len) {
+template<int Position, int Order>                   // Position: column of Xposition Yposition Zposition, -1 if none
+static void decodeLayout (BVH::Part* part, const float* values, int pitch, int first, int count) {
     
-	if (strncmp (s, key, len) != 0) return false;
-	s += len;
-	return true;
+	const int rotation = Position == 0? 3: 0;       // Rotations take the other three columns
+    
+	if (Position >= 0) {
+        
+		const float* x = values + Position * pitch;
+		const float* y = x + pitch;
+		const float* z = y + pitch;
+        
+		const int       stride = part->positionStride;
+		BVH_Math::vec3* out    = part->position + (size_t) first * stride;
+        
+		for (int k=0; k<count; ++k) out[k * stride] = BVH_Math::vec3 (x[k], y[k], z[k]);
+	}
+    
+	const float* a = values + rotation * pitch;
+    
+	BVH_Math::eulerToQuaternion ((BVH_Math::RotationOrder) Order, a, a + pitch, a + 2*pitch, count,
+	                             part->rotation + (size_t) first * part->rotationStride, part->rotationStride, toRad);
 }
 
-inline bool readFloat (const char*& data, float& out) {
+static void decodeChannels (BVH::Part* part, const float* values, int pitch, int first, int count) {
     
-	char* end;
-	out = strtod (data, &end);
+	const BVH_Math::vec3 xAxis (1,0,0);             // Any other layout, one channel at a time
+	const BVH_Math::vec3 yAxis (0,1,0);
+	const BVH_Math::vec3 zAxis (0,0,1);
     
-    if (end > data) {
+	for (int k=0; k<count; ++k) {
+        
+		BVH_Math::vec3       pos = part->offset;
+		BVH_Math::Quaternion rot;
         
-        data += end - data;
-        return true;
+		const float* value = values + k;
         
-    } else return false;
+		for (int channel = part->channels; channel; channel >>= 3, value += pitch) {
+            
+			switch (channel & 0x7) {
+                    
+				case BVH::Xpos: pos.x = *value; break;
+				case BVH::Ypos: pos.y = *value; break;
+				case BVH::Zpos: pos.z = *value; break;
+                    
+				case BVH::Xrot: rot = rot * BVH_Math::Quaternion (xAxis, *value * toRad); break;
+				case BVH::Yrot: rot = rot * BVH_Math::Quaternion (yAxis, *value * toRad); break;
+				case BVH::Zrot: rot = rot * BVH_Math::Quaternion (zAxis, *value * toRad); break;
+			}
+		}
+        
+		part->rotation[(size_t) (first + k) * part->rotationStride] = rot;
+        
+		if (part->position) part->position[(size_t) (first + k) * part->positionStride] = pos;
+	}
 }
 
-inline bool readInt (const char*& data, int& out) {
+#define LAYOUTS(position) { &decodeLayout<position, BVH_Math::XYZ>, &decodeLayout<position, BVH_Math::XZY>, \
+                            &decodeLayout<position, BVH_Math::YXZ>, &decodeLayout<position, BVH_Math::YZX>, \
+                            &decodeLayout<position, BVH_Math::ZXY>, &decodeLayout<position, BVH_Math::ZYX> }
+
+BVH::Decoder BVH::chooseDecoder (int channels) {
     
-	char* end;
-	out = (int)strtol (data, &end, 10);
+	static const Decoder layouts[3][6] = { LAYOUTS(-1), LAYOUTS(0), LAYOUTS(3) };
     
-    if (end > data) {
-        
-        data += end - data;
-        return true;
-        
-    } else return false;
+	const int positions = BVH::Xpos | BVH::Ypos << 3 | BVH::Zpos << 6;
+	const int order     = rotationOrder (channels);
+    
+	int count = 0;
+    
+	for (int c = channels; c; c >>= 3) ++count;
+    
+	if (order < 0) return &decodeChannels;
+    
+	if (count == 3)                                            return layouts[0][order];
+	if (count == 6 && (channels & 0777) == positions)          return layouts[1][order];
+	if (count == 6 && (channels >> 9 & 0777) == positions)     return layouts[2][order];
+    
+	return &decodeChannels;
 }
 
-BVH::Part* BVH::readHeirachy (const char*& data) {
+#undef LAYOUTS
+
+BVH::BVH() : m_root(0), m_parts(0), m_partCount(0), m_frames(0), m_frameTime(0), m_source(0), m_sourceEnd(0), m_loaded(false), m_channelCount(0), m_cancel(0), m_cache(0) {}
+
+BVH::~BVH() {
     
-	whitespace (data);
+	delete m_cache;                             // Parts and tracks go with their arenas
+}
+
+int BVH::readHeirachy (const char*& data, const char* end, Hierarchy& out) {
+    
+	whitespace (data, end);
 
 	int len          = 0;                       // Parse name
 	const char *name = data;
     
-	while ((data[len]>='*' && data[len]<='z') || data[len]==' ') ++len;
+	while (data+len<end && ((data[len]>='*' && data[len]<='z') || data[len]==' ')) ++len;
     
 	data += len;
-	whitespace (data);
+	whitespace (data, end);
     
-	while (name[len]==' ') --len;               // Trim
+	while (len>0 && name[len-1]==' ') --len;    // Trim
 
-	if (!word (data, "{", 1)) return 0;         // Block start
+	if (!word (data, end, "{", 1)) return -1;   // Block start
 
-	Part* part = new Part;                      // Create part
+	Part part;                                  // Create part
     
-	part->parent       = -1;
-	part->name         = 0;
-	part->channels     = 0;
-	part->motion       = 0;
-    part->childIndices = std::vector<int>();
-
-	if (len>0) {                                // Get part name
-        
-		part->name  = new char[len+1];
-		memcpy (part->name, name, len);
-		part->name[len] = 0;                    // null terminated
-	}
+	part.parent         = -1;
+	part.name           = 0;
+	part.channels       = 0;
+	part.childCount     = 0;
+	part.rotation       = 0;
+	part.position       = 0;
+	part.rotationStride = 1;
+	part.positionStride = 1;
+	part.packedRotation = 0;
+	part.packedPosition = 0;
+	part.keyCount       = 0;
+	part.keyFrames      = 0;
+	part.keys           = 0;
+	part.children       = 0;
 
-	if (~m_partCount & 0x7) {                   // Add part to flat list
-        
-		Part** list = new Part*[(m_partCount&0xff8) + 0x8];
-        
-		if (m_partCount) memcpy (list, m_parts, m_partCount * sizeof (Part*));
-        
-		delete []   m_parts;
-		m_parts     = list;
-	}
-    
-	int partIndex      = m_partCount;
+	int partIndex      = (int) out.parts.size();
     int channelCount   = 0;
     int childCount     = 0;
     
-    part->index        = partIndex;
+    part.index         = partIndex;
     
-	m_parts[partIndex] = part;
+	out.parts.push_back (part);                 // Add part to flat list, children follow it
+	out.names.push_back (len>0? (int) out.text.size(): -1);
     
-	m_partCount++;
+	if (len>0) {                                // Get part name
+        
+		out.text.insert (out.text.end(), name, name + len);
+		out.text.push_back (0);                 // null terminated
+	}
 
-	while (*data) {                             // Part data
+	while (data<end) {                          // Part data
         
-		whitespace (data);
+		whitespace (data, end);
 
-		if (word (data, "OFFSET", 6)) {         // Read joint offset
+		if (word (data, end, "OFFSET", 6)) {    // Read joint offset
             
-			readFloat (data, part->offset.x);
-			readFloat (data, part->offset.y);
-			readFloat (data, part->offset.z);
+			readFloat (data, end, part.offset.x);
+			readFloat (data, end, part.offset.y);
+			readFloat (data, end, part.offset.z);
 		}
 
-		else if (word (data, "CHANNELS", 8)) {  // Read active channels
+		else if (word (data, end, "CHANNELS", 8)) { // Read active channels
             
-			readInt (data, channelCount);
+			readInt (data, end, channelCount);
             
 			for (int i=0; i<channelCount; ++i) {
                 
-				whitespace (data);
+				whitespace (data, end);
                 
-				if      (word (data, "Xposition", 9)) part->channels |= Xpos << (i*3);
-				else if (word (data, "Yposition", 9)) part->channels |= Ypos << (i*3);
-				else if (word (data, "Zposition", 9)) part->channels |= Zpos << (i*3);
-				else if (word (data, "Xrotation", 9)) part->channels |= Xrot << (i*3);
-				else if (word (data, "Yrotation", 9)) part->channels |= Yrot << (i*3);
-				else if (word (data, "Zrotation", 9)) part->channels |= Zrot << (i*3);
+				if      (word (data, end, "Xposition", 9)) part.channels |= Xpos << (i*3);
+				else if (word (data, end, "Yposition", 9)) part.channels |= Ypos << (i*3);
+				else if (word (data, end, "Zposition", 9)) part.channels |= Zpos << (i*3);
+				else if (word (data, end, "Xrotation", 9)) part.channels |= Xrot << (i*3);
+				else if (word (data, end, "Yrotation", 9)) part.channels |= Yrot << (i*3);
+				else if (word (data, end, "Zrotation", 9)) part.channels |= Zrot << (i*3);
 				else    { printf ("BVH::readHeirachy: Invalid channel %.10s\n", data); break; }
 			}
 		}
 
-		else if (word (data, "JOINT", 5)) {     // Read child part
+		else if (word (data, end, "JOINT", 5)) { // Read child part
             
-			Part* child = readHeirachy (data);
+			int child = readHeirachy (data, end, out);
             
-			if (!child) break;
+			if (child < 0) break;
 
             ++childCount;
 
-            child->parent = partIndex;
-			part->end     = part->end + child->offset;
-
-            part->childIndices.push_back (child->index);
+            out.parts[child].parent = partIndex;
+			part.end = part.end + out.parts[child].offset;
 		}
 
-		else if (word (data, "End Site", 8)) {  // End point
+		else if (word (data, end, "End Site", 8)) { // End point
             
-			whitespace (data);
+			whitespace (data, end);
             
-			word (data, "{", 1);                // get length of end bone
+			word (data, end, "{", 1);           // get length of end bone
             
-			while (*data) {
+			while (data<end) {
                 
-				whitespace (data);
+				whitespace (data, end);
                 
-				if (word (data, "}", 1)) break;
-				if (word (data, "OFFSET", 6)) {
+				if (word (data, end, "}", 1)) break;
+				if (word (data, end, "OFFSET", 6)) {
                     
-					readFloat (data, part->end.x);
-					readFloat (data, part->end.y);
-					readFloat (data, part->end.z);
+					readFloat (data, end, part.end.x);
+					readFloat (data, end, part.end.y);
+					readFloat (data, end, part.end.z);
 				}
+				else nextLine (data, end);      // Unknown or cut short, skip it
 			}
 		}
 
-		else if (word (data, "}", 1)) {         // End block
+		else if (word (data, end, "}", 1)) {    // End block
             
-			if (childCount>0) part->end *= 1.0 / childCount;
+			if (childCount>0) part.end *= 1.0 / childCount;
             
-            part->childCount = childCount;
+            part.childCount = childCount;
             
-			return part;
+			out.parts[partIndex] = part;
+			return partIndex;
 		}
 
-		else nextLine (data);                   // Error?
+		else nextLine (data, end);              // Error?
 	}
     
-	delete [] part->name;
-	delete part;
-	return 0;
+	return -1;
 }
 
-bool BVH::load (const char* data) {
+void BVH::setHierarchy (const Hierarchy& hierarchy) {
+    
+	int count = (int) hierarchy.parts.size();
+    
+	m_hierarchy.reserve<Part> (count);          // One block: parts, child lists, names
+	m_hierarchy.reserve<int>  (count);
+	m_hierarchy.reserve<char> (hierarchy.text.size());
+	m_hierarchy.commit();
+    
+	m_parts     = m_hierarchy.allocate<Part> (count);
+	m_partCount = count;
+	m_root      = count? m_parts: 0;
     
-	while (*data) {
+	int*  children = m_hierarchy.allocate<int>  (count);
+	char* names    = m_hierarchy.allocate<char> (hierarchy.text.size());
+    
+	if (!hierarchy.text.empty()) memcpy (names, &hierarchy.text[0], hierarchy.text.size());
+    
+	for (int i=0; i<count; ++i) {
+        
+		m_parts[i]            = hierarchy.parts[i];
+		m_parts[i].name       = hierarchy.names[i] >= 0? names + hierarchy.names[i]: 0;
+		m_parts[i].children   = children;       // Placed below
+		m_parts[i].childCount = 0;
+	}
+    
+	for (int i=1; i<count; ++i) ++m_parts[m_parts[i].parent].childCount;
+    
+	for (int i=0, next=0; i<count; ++i) {       // Child lists in part order (CSR)
+        
+		m_parts[i].children = children + next;
+		next += m_parts[i].childCount;
+	}
+    
+	std::vector<int> filled (count, 0);
+    
+	for (int i=1; i<count; ++i) {               // Parents come first, so each list is ascending
         
-		whitespace (data);
+		int parent = m_parts[i].parent;
+		children[m_parts[parent].children - children + filled[parent]++] = i;
+	}
+}
 
-		if (word (data, "HIERARCHY", 9)) {      // Load bone heirachy
+bool BVH::load (const char* data, size_t length, int threads) {
+    
+	bool ok = open (data, length) && loadFrames (threads);
+    
+	releaseSource();
+	return ok;
+}
+
+bool BVH::open (const char* data, size_t length) {
+    
+	const char* end = data + length;
+    
+	m_loaded = false;
+    
+	if (!readHeader (data, end)) return false;
+    
+	m_source    = data;                         // The frame lines, for loadFrames
+	m_sourceEnd = end;
+    
+	return m_frames > 0;
+}
+
+bool BVH::readHeader (const char*& data, const char* end) {
+    
+	while (data<end) {
+        
+		whitespace (data, end);
+
+		if (word (data, end, "HIERARCHY", 9)) { // Load bone heirachy
             
-			nextLine (data);
+			nextLine (data, end);
             
-			if (word (data, "ROOT", 4)) {
+			if (word (data, end, "ROOT", 4)) {
+                
+				Hierarchy hierarchy;
                 
-				m_root = readHeirachy (data);
+				if (readHeirachy (data, end, hierarchy) < 0) return false;
                 
-				if (!m_root) return false;
+				setHierarchy (hierarchy);
 			}
 		}
 
-        else if (word (data, "MOTION", 6)) {    // Load motion data
+        else if (word (data, end, "MOTION", 6)) { // Load motion header
             
-            whitespace (data);
+            whitespace (data, end);
             
-            if (word (data, "Frames:", 7)) {
+            if (word (data, end, "Frames:", 7)) {
                 
-                readInt (data, m_frames);
-                whitespace (data);
+                readInt (data, end, m_frames);
+                whitespace (data, end);
             }
             
-            if (word (data, "Frame Time:", 11)) {
+            if (word (data, end, "Frame Time:", 11)) {
                 
-                readFloat (data, m_frameTime);
-                whitespace (data);
+                readFloat (data, end, m_frameTime);
+                whitespace (data, end);
             }
             
-            for (int i=0; i<m_partCount; ++i) { // Initialise memory
-                
-                m_parts[i]->motion = new BVH_Math::Transform[m_frames];
-            }
+            return m_root && !cancelled();      // data is at the first frame
             
-            int     partIndex;
-            int     channel;
-            Part*   part;
-            float   value;
+        } else return false;
+	}
+    
+	return false;
+}
+
+bool BVH::cancelled() const {
+    
+	return m_cancel && base::loadAcquire (m_cancel);
+}
+
+void BVH::releaseSource() {
+    
+	m_source    = 0;
+	m_sourceEnd = 0;
+}
+
+void BVH::releaseMotion() {
+    
+	for (int i=0; i<m_partCount; ++i) {         // Every frame now reads as not loaded
+        
+		Part* part = &m_parts[i];
+        
+		part->rotation       = 0;
+		part->position       = 0;
+		part->rotationStride = 0;
+		part->positionStride = 0;
+		part->packedRotation = 0;
+		part->packedPosition = 0;
+		part->keyCount       = 0;
+		part->keyFrames      = 0;
+		part->keys           = 0;
+	}
+    
+	m_motion.clear();
+	delete m_cache;
+	m_cache = 0;
+    
+	releaseSource();
+	std::vector<int>().swap (m_columns);
+	std::vector<Decoder>().swap (m_decoders);
+	std::vector<BVH_Math::vec3>().swap (m_rootPath);
+	m_loaded = false;
+}
+
+template<class T> inline void resetVector (std::vector<T>& v, size_t keep) {
+    
+	if (v.capacity() * sizeof (T) > keep) std::vector<T>().swap (v);
+	else v.clear();
+}
+
+void BVH::reset (size_t keep) {
+    
+	m_root      = 0;                            // Parts go with the hierarchy block
+	m_parts     = 0;
+	m_partCount = 0;
+	m_frames    = 0;
+	m_frameTime = 0;
+	m_loaded    = false;
+	m_cancel    = 0;
+    
+	delete m_cache;
+	m_cache = 0;
+    
+	releaseSource();
+	resetVector (m_columns, keep);
+	resetVector (m_decoders, keep);
+	resetVector (m_rootPath, keep);
+	m_channelCount = 0;
+    
+	m_hierarchy.reset (keep);
+	m_motion.reset (keep);
+}
+
+size_t BVH::memoryUsage() const {
+    
+	return sizeof (BVH) + m_hierarchy.capacity() + m_motion.capacity() + (m_cache? m_cache->size(): 0) +
+	       m_columns.capacity() * sizeof (int) + m_decoders.capacity() * sizeof (Decoder) +
+	       m_rootPath.capacity() * sizeof (BVH_Math::vec3);
+}
+
+void BVH::computeRootPath() {
+    
+	m_rootPath.clear();
+    
+	if (!m_partCount) return;
+    
+	m_rootPath.reserve (m_frames);
+    
+	BVH_Math::Transform root;
+	int cursor = 0;                             // Walking forward keeps reduced tracks linear
+    
+	for (int i=0; i<m_frames; ++i) {
+        
+		if (m_parts[0].keys) sampleKeys (&m_parts[0], i, root, cursor);
+		else getTransform (&m_parts[0], i, root);
+        
+		m_rootPath.push_back (root.offset);
+	}
+}
+
+void BVH::getPose (float frame, BVH_Math::Transform* out, int* cursor) const {
+    
+	int   f = (int) frame;
+	float t = frame - f;
+    
+	if (f >= m_frames-1) { f = m_frames-1; t = 0.f; }
+    
+	for (int i=0; i<m_partCount; ++i) {         // Walks one row of each frame major array
+        
+		const Part* part = &m_parts[i];
+        
+		if (part->keys) {
             
-            BVH_Math::vec3       pos;
-            BVH_Math::Quaternion rot;
+			sampleKeys (part, f + t, out[i], cursor[i]);
+			continue;
+		}
+        
+		getTransform (part, f, out[i]);
+        
+		if (t > 0) {
             
-            const BVH_Math::vec3 xAxis (1,0,0);
-            const BVH_Math::vec3 yAxis (0,1,0);
-            const BVH_Math::vec3 zAxis (0,0,1);
+			BVH_Math::Transform next;
+			getTransform (part, f+1, next);
             
-            const float toRad = 3.141592653592f / 180;
+			out[i].offset   = BVH_Math::lerp (out[i].offset, next.offset, t);
+			out[i].rotation = BVH_Math::slerp (out[i].rotation, next.rotation, t);
+		}
+	}
+}
+
+bool BVH::allocateFrames (int frames, int keep) {
+    
+	int positions = 0;                          // Frame major, translation only where there are channels for it
+    
+	for (int i=0; i<m_partCount; ++i) positions += hasPosition (m_parts[i].channels);
+    
+	Arena  grown;                               // Frames kept are copied out of the current block
+	Arena& motion = keep > 0? grown: m_motion;
+    
+	motion.reserve<BVH_Math::Quaternion> ((size_t) frames * m_partCount);
+	motion.reserve<BVH_Math::vec3>       ((size_t) frames * positions);
+    
+	if (!motion.commit()) return false;
+    
+	BVH_Math::Quaternion* rotation = motion.allocate<BVH_Math::Quaternion> ((size_t) frames * m_partCount);
+	BVH_Math::vec3*       position = motion.allocate<BVH_Math::vec3>       ((size_t) frames * positions);
+    
+	if (keep > 0) {
+        
+		memcpy (rotation, m_parts[0].rotation, (size_t) keep * m_partCount * sizeof (BVH_Math::Quaternion));
+        
+		for (int i=0; i<m_partCount; ++i) {     // The first part with a position track starts the block
             
-            for (int frame=0; frame<m_frames; ++frame) {    // Read frames
-                
-                partIndex   = 0;
-                part        = m_parts[0];
-                channel     = part->channels;
-                
-                while (*data) {
-                    
-                    readFloat (data, value);
-
-                    switch (channel & 0x7) {
-                            
-                        case Xpos: pos.x = value; break;
-                        case Ypos: pos.y = value; break;
-                        case Zpos: pos.z = value; break;
-                            
-                        case Xrot: rot = rot * BVH_Math::Quaternion (xAxis, value*toRad); break;
-                        case Yrot: rot = rot * BVH_Math::Quaternion (yAxis, value*toRad); break;
-                        case Zrot: rot = rot * BVH_Math::Quaternion (zAxis, value*toRad); break;
-                    }
-                    
-                    channel >>= 3;
-                    
-                    if (channel == 0) {                     // Read all values for this part
-                        
-                        part->motion[frame].rotation = rot;
-                        part->motion[frame].offset   = pos;
-                        
-                        ++partIndex;                        // Next part
-                        
-                        rot     = BVH_Math::Quaternion();
-                        
-                        if (partIndex == m_partCount) break;
-                        
-                        part    = m_parts[partIndex];
-                        channel = part->channels;
-                    }
-                }
+			if (!m_parts[i].position) continue;
+            
+			std::copy (m_parts[i].position, m_parts[i].position + (size_t) keep * positions, position);
+			break;
+		}
+        
+		m_motion.swap (grown);                  // Old block goes with the local
+	}
+    
+	m_columns.resize (m_partCount);
+	m_decoders.resize (m_partCount);
+	m_channelCount = 0;
+    
+	for (int i=0, slot=0; i<m_partCount; ++i) {
+        
+		Part* part = &m_parts[i];
+        
+		m_columns[i]  = m_channelCount;
+		m_decoders[i] = chooseDecoder (part->channels);
+        
+		for (int c = part->channels; c; c >>= 3) ++m_channelCount;
+        
+		part->rotation       = rotation + i;
+		part->rotationStride = m_partCount;
+		part->position       = hasPosition (part->channels)? position + slot++: 0;
+		part->positionStride = part->position? positions: 0;
+	}
+    
+	return true;
+}
+
+bool BVH::loadFrames (int threads) {
+    
+	if (m_loaded) return true;
+    
+	if (!m_source || cancelled()) return false;     // Source already released, or no longer wanted
+    
+	std::vector<const char*> lines;
+    
+	if (!findLines (lines)) return false;       // Before allocating, it may find fewer frames
+    
+	if (!allocateFrames (m_frames) || !readFrames (lines, threads)) return false;
+    
+	m_loaded = true;
+	shareConstantTracks();
+    
+	return m_frames > 0;
+}
+
+void BVH::countTracks (int& rotations, int& positions, int& constantRotations, int& constantPositions) const {
+    
+	rotations = positions = constantRotations = constantPositions = 0;
+    
+	for (int i=0; i<m_partCount; ++i) {
+        
+		const Part* part = &m_parts[i];
+        
+		if (part->rotationStride) ++rotations; else ++constantRotations;
+        
+		if (part->position || part->packedPosition) {
+            
+			if (part->positionStride) ++positions; else ++constantPositions;
+		}
+	}
+}
+
+void BVH::shareConstantTracks() {
+    
+	if (m_cache || !m_partCount || !m_parts[0].rotation || !m_parts[0].rotationStride) return;
+    
+	std::vector<int> rotationStride (m_partCount);  // Current strides, zeroed below for tracks that never change
+	std::vector<int> positionStride (m_partCount);
+    
+	bool shrink = false;
+    
+	for (int i=0; i<m_partCount; ++i) {
+        
+		Part* part = &m_parts[i];
+        
+		rotationStride[i] = part->rotationStride;
+		positionStride[i] = part->positionStride;
+        
+		int f = 1, stride = part->rotationStride;
+        
+		while (f<m_frames && memcmp (&part->rotation[f*stride], &part->rotation[0], sizeof (BVH_Math::Quaternion)) == 0) ++f;
+        
+		if (f == m_frames) part->rotationStride = 0;
+        
+		if (part->position) {
+            
+			f      = 1;
+			stride = part->positionStride;
+            
+			while (f<m_frames && memcmp (&part->position[f*stride], &part->position[0], sizeof (BVH_Math::vec3)) == 0) ++f;
+            
+			if (f == m_frames) part->positionStride = 0;
+		}
+        
+		shrink |= !part->rotationStride || (part->position && !part->positionStride);
+	}
+    
+	if (!shrink) return;
+    
+	int rotations, positions, constantRotations, constantPositions;
+    
+	countTracks (rotations, positions, constantRotations, constantPositions);
+    
+	Arena motion;                               // Repack, constant tracks stored once ahead of the animated ones
+    
+	motion.reserve<BVH_Math::Quaternion> (constantRotations + (size_t) m_frames * rotations);
+	motion.reserve<BVH_Math::vec3>       (constantPositions + (size_t) m_frames * positions);
+    
+	if (!motion.commit()) {
+        
+		for (int i=0; i<m_partCount; ++i) {     // Keep the old layout
+            
+			m_parts[i].rotationStride = rotationStride[i];
+			m_parts[i].positionStride = positionStride[i];
+		}
+        
+		return;
+	}
+    
+	BVH_Math::Quaternion* rotation = motion.allocate<BVH_Math::Quaternion> (constantRotations + (size_t) m_frames * rotations);
+	BVH_Math::vec3*       position = motion.allocate<BVH_Math::vec3>       (constantPositions + (size_t) m_frames * positions);
+    
+	int rotationSlot = 0, constantRotation = 0;
+	int positionSlot = 0, constantPosition = 0;
+    
+	for (int i=0; i<m_partCount; ++i) {
+        
+		Part* part = &m_parts[i];
+        
+		if (part->rotationStride) {
+            
+			BVH_Math::Quaternion* track = rotation + constantRotations + rotationSlot++;
+            
+			for (int f=0; f<m_frames; ++f) track[f*rotations] = part->rotation[f*rotationStride[i]];
+            
+			part->rotation       = track;
+			part->rotationStride = rotations;
+            
+		} else {
+            
+			rotation[constantRotation] = part->rotation[0];
+			part->rotation = rotation + constantRotation++;
+		}
+        
+		if (!part->position) continue;
+        
+		if (part->positionStride) {
+            
+			BVH_Math::vec3* track = position + constantPositions + positionSlot++;
+            
+			for (int f=0; f<m_frames; ++f) track[f*positions] = part->position[f*positionStride[i]];
+            
+			part->position       = track;
+			part->positionStride = positions;
+            
+		} else {
+            
+			position[constantPosition] = part->position[0];
+			part->position = position + constantPosition++;
+		}
+	}
+    
+	m_motion.swap (motion);                     // Old block goes with the local
+}
+
+bool BVH::readFrame (const char* data, const char* end, float* values, int pitch) {
+    
+	for (int i=0; i<m_channelCount; ++i, values += pitch) {
+        
+		if (!readFloat (data, end, *values)) return false;     // Short line
+	}
+    
+	return true;
+}
+
+void BVH::decodeFrames (int first, int count, const float* values, int pitch) {
+    
+	for (int i=0; i<m_partCount; ++i) m_decoders[i] (&m_parts[i], values + m_columns[i] * pitch, pitch, first, count);
+}
+
+struct BVH::FrameRange {
+    
+	BVH*               bvh;
+	const char* const* lines;                   // Line start of each frame from first, plus one past last
+	int                first;
+	int                last;
+	int                failed;                  // First bad frame, or -1
+};
+
+void BVH::readFrameRange (FrameRange* range) {
+    
+	const int batch = 64;                       // Frames tokenized before decoding, one column per channel
+    
+	std::vector<float> values ((size_t) range->bvh->m_channelCount * batch + 1);
+    
+	range->failed = -1;
+    
+	for (int start=range->first; start<range->last && range->failed<0; start+=batch) {
+        
+		if (range->bvh->cancelled()) return;    // Checkpoint, every batch of frames
+        
+		int count = range->last - start < batch? range->last - start: batch;
+        
+		for (int k=0; k<count; ++k) {
+            
+			const char* const* line = range->lines + (start + k - range->first);
+            
+			if (!range->bvh->readFrame (line[0], line[1], &values[k], batch)) {
                 
-                nextLine (data);
-            }
+				range->failed = start + k;
+				count         = k;
+				break;
+			}
+		}
+        
+		range->bvh->decodeFrames (start, count, &values[0], batch);
+	}
+}
+
+bool BVH::findLines (std::vector<const char*>& lines) {
+    
+	const char* s   = m_source;
+	const char* end = m_sourceEnd;
+    
+	lines.clear();                              // Pass 1: one pass over the line ends, no parsing
+	lines.reserve ((size_t) m_frames < (size_t) (end - s)? m_frames + 1: end - s + 1);
+    
+	int frame = 0;
+    
+	for (; frame < m_frames; ++frame) {
+        
+		whitespace (s, end);                    // Also skips blank lines
+        
+		if (s >= end) break;
+        
+		lines.push_back (s);
+        
+		const char* eol = (const char*) memchr (s, '\n', end - s);
+		s = eol? eol + 1: end;
+	}
+    
+	lines.push_back (s);
+    
+	if (frame < m_frames) {                     // Truncated capture
+        
+		printf ("BVH::findLines: Expected %d frames, found %d\n", m_frames, frame);
+		m_frames = frame;
+	}
+    
+	whitespace (s, end);
+    
+	if (s < end) printf ("BVH::findLines: Ignoring data after frame %d\n", m_frames);
+    
+	return m_frames > 0;
+}
+
+bool BVH::readFrames (const std::vector<const char*>& lines, int threads) {
+    
+	const int frames = (int) lines.size() - 1;
+    
+	const int minFrames = 256;                  // Not worth a thread below this
+    
+	if (threads > frames / minFrames) threads = frames / minFrames;
+	if (threads < 1) threads = 1;
+    
+	std::vector<FrameRange>   ranges (threads); // Pass 2: parse contiguous ranges in parallel
+	std::vector<base::Thread> workers (threads - 1);
+    
+	for (int i=0; i<threads; ++i) {
+        
+		ranges[i].bvh    = this;
+		ranges[i].first  = (long long) frames * i / threads;
+		ranges[i].last   = (long long) frames * (i+1) / threads;
+		ranges[i].lines  = &lines[ranges[i].first];
+		ranges[i].failed = -1;
+        
+		if (i > 0) workers[i-1].begin (&readFrameRange, &ranges[i]);
+	}
+    
+	readFrameRange (&ranges[0]);                // Calling thread takes the first range
+    
+	for (int i=1; i<threads; ++i) workers[i-1].join();
+    
+	if (cancelled()) return false;              // Ranges stopped early, nothing to validate
+    
+	for (int i=0; i<threads; ++i) {             // Pass 3: validate
+        
+		if (ranges[i].failed < 0) continue;
+        
+		if (ranges[i].failed == m_frames-1) {   // Cut off mid line
             
-        } else return false;
+			printf ("BVH::readFrames: Dropping incomplete frame %d\n", ranges[i].failed);
+			--m_frames;
+			break;
+		}
+        
+		printf ("BVH::readFrames: Frame %d has too few values\n", ranges[i].failed);
+		return false;
 	}
     
-	return m_root && m_frames;
+	return true;
 }
@@ -2,7 +2,12 @@
 #define _BVH_
 
 #include <vector>
+#include <cstddef>
+#include <stdint.h>
 #include "bvh_math.h"
+#include "arena.h"
+
+class MappedFile;
 
 /** bvh mocap data */
 
@@ -12,17 +17,52 @@ class BVH {
 
 		enum Channel { Xpos=1, Ypos, Zpos, Xrot, Yrot, Zrot };
 
+		struct PackedQuaternion { uint16_t v[3]; };	// Smallest three quaternion
+		struct PackedVec3       { uint16_t v[3]; };	// Normalised to the part's range
+
 		struct Part {
 
-			char*               	name;
+			const char*         	name;				// Points into the hierarchy block
 			int                 	index;
 			int                 	parent;
 			int                 	channels;
 			int                 	childCount;
 			BVH_Math::vec3       	offset;
 			BVH_Math::vec3       	end;
-			BVH_Math::Transform*	motion;
-			std::vector<int>    	childIndices;
+			BVH_Math::Quaternion*	rotation;			// Frame 0, or null once compacted or reduced
+			BVH_Math::vec3*      	position;			// Only for parts with position channels
+			int                 	rotationStride;		// Entries per frame, 0 if the track never changes
+			int                 	positionStride;
+			PackedQuaternion*   	packedRotation;		// Compacted tracks, same strides
+			PackedVec3*         	packedPosition;
+			BVH_Math::vec3       	packMin;
+			BVH_Math::vec3       	packScale;
+			int                 	keyCount;			// Reduced track, interpolated between keys
+			int*                	keyFrames;
+			BVH_Math::Transform*	keys;
+			const int*          	children;			// childCount part indices
+		};
+
+		typedef size_t (*ReadFunction) (void* user, char* buffer, size_t size);	// Bytes read, 0 at the end
+
+		struct Stream {							// Text read a window at a time, see openStream()
+
+			Stream (ReadFunction read, void* user, std::vector<char>& window);
+
+			bool fill();						// Keep the unparsed text, read more after it, false at the end
+
+			ReadFunction       read;
+			void*              user;
+			std::vector<char>* window;			// Grown when a header or line does not fit
+			size_t             begin, end;		// Unparsed text in the window
+			bool               finished;
+		};
+
+		struct Stamp {							// Identifies the source a cache file was built from
+
+			uint64_t size;
+			int64_t  mtime;
+			uint64_t hash;
 		};
 
 	public:
@@ -30,24 +70,115 @@ class BVH {
 		BVH();
 		~BVH();
 
-		bool load(const char* data);
+		bool load(const char* data, size_t length, int threads=1);	// data need not be null terminated
+
+		bool open(const char* data, size_t length);				// Hierarchy only, the frames are left to loadFrames()
+		bool loadFrames(int threads=1);								// Parse every frame of the data passed to open()
+		void releaseSource();										// Call before the data passed to open() goes away
+		bool openStream(Stream& stream);							// Hierarchy only, as open(), reads no further than the frames
+		bool loadStream(Stream& stream);							// Every frame from the rest of the stream
+		void setCancel(const bool* flag) { m_cancel = flag; }		// Parsing gives up once *flag is set by another thread
+		bool cancelled() const;
+
+		void   releaseMotion();										// Drop every track, keep the hierarchy
+		void   reset(size_t keep);									// Back to an empty clip, keeping allocations up to keep bytes to open the next
+		size_t memoryUsage() const;									// Bytes held, including a mapped cache
+		void   computeRootPath();									// Root offset of every frame, for framing the clip
+
+		bool writeCache(const char* path, const Stamp& stamp) const;	// Binary .bvhc of a fully loaded clip
+		bool openCache(const char* path, Stamp& stamp);				// Map a .bvhc file, stamp receives its source
+		bool saveMotion(std::vector<unsigned char>& out) const;		// Tracks of a loaded clip, deflated
+		bool restoreMotion(const unsigned char* data, size_t size);	// Undo releaseMotion from saveMotion output
+		static uint64_t hash(const char* data, size_t length);		// Content hash for Stamp
+
+		bool compact(float& rotationError, float& offsetError);		// Quantise motion, returns worst radians and units
+		float reduce(float angleTolerance, float offsetTolerance,	// Drop keys within tolerance (radians, units),
+		             float& rotationError, float& offsetError);		// returns kept / original keys
+
+		void sampleKeys(const Part* part, float frame, BVH_Math::Transform& out, int& cursor) const;	// cursor makes playback O(1)
+		void getPose(float frame, BVH_Math::Transform* out, int* cursor) const;	// Local transform of every part, cursor per part
+
+		/** Tracks are frame major: all animated rotations of a frame are adjacent, then all animated
+		 *  positions in a second array. Constant tracks are stored once ahead of them. */
+
+		void getTransform(const Part* part, int frame, BVH_Math::Transform& out) const {
+
+			if (part->rotation) {
+
+				out.rotation = part->rotation[frame * part->rotationStride];
+				out.offset   = part->position? part->position[frame * part->positionStride]: part->offset;
+				return;
+			}
+
+			if (part->keys) { int cursor = -1; sampleKeys (part, frame, out, cursor); return; }	// No cursor, binary search
+
+			out.rotation = BVH_Math::unpackQuaternion (part->packedRotation[frame * part->rotationStride].v);
+
+			if (part->packedPosition) {
+
+				const uint16_t* p = part->packedPosition[frame * part->positionStride].v;
+
+				out.offset = BVH_Math::vec3 (part->packMin.x + p[0] * part->packScale.x,
+				                             part->packMin.y + p[1] * part->packScale.y,
+				                             part->packMin.z + p[2] * part->packScale.z);
+
+			} else out.offset = part->offset;
+		}
 
 		int         getPartCount() const		{ return m_partCount; }
-		const Part* getPart(int index) const    { return m_parts[index]; }
+		const Part* getPart(int index) const    { return &m_parts[index]; }
 		int         getFrames() const           { return m_frames; }
 		float       getFrameTime() const        { return m_frameTime; }
+		bool        hasFrame(int frame) const   { return m_loaded && frame>=0 && frame<m_frames; }
+		const std::vector<BVH_Math::vec3>& getRootPath() const { return m_rootPath; }	// Empty until computed
 
 	private:
 
-		Part* readHeirachy (const char*& data);
+		struct FrameRange;
+
+		struct Hierarchy {							// Parsed joints before they are laid out
+
+			std::vector<Part> parts;
+			std::vector<int>  names;				// Offset into text, or -1
+			std::vector<char> text;
+		};
+
+		int   readHeirachy (const char*& data, const char* end, Hierarchy& out);
+		bool  readHeader   (const char*& data, const char* end);
+		bool  allocateFrames (int frames, int keep=0);		// Tracks for frames, copying the first keep of the current ones
+		void  setHierarchy (const Hierarchy& hierarchy);
+		bool  findLines    (std::vector<const char*>& lines);
+		bool  readFrames   (const std::vector<const char*>& lines, int threads);
+		bool  readFrame    (const char* data, const char* end, float* values, int pitch);
+		void  decodeFrames (int first, int count, const float* values, int pitch);
+		void  shareConstantTracks();
+		void  countTracks (int& rotations, int& positions, int& constantRotations, int& constantPositions) const;
+
+		typedef void (*Decoder) (Part* part, const float* values, int pitch, int first, int count);
+
+		static void    readFrameRange (FrameRange* range);
+		static Decoder chooseDecoder  (int channels);
 
 	protected:
 
 		Part*  m_root;
-		Part** m_parts;
+		Part*  m_parts;								// Flat, parents before children
 		int    m_partCount;
 		int    m_frames;
 		float  m_frameTime;
+
+		const char*         m_source;				// Frame lines of the text passed to open()
+		const char*         m_sourceEnd;
+		bool                m_loaded;				// Every frame is in, until releaseMotion
+		int                 m_channelCount;			// Values per frame line
+		std::vector<int>    m_columns;				// First value of each part within a frame
+		std::vector<Decoder> m_decoders;			// Per part, chosen from its CHANNELS layout
+		const bool*         m_cancel;				// Checked between blocks of frames
+
+		Arena               m_hierarchy;			// Parts, child lists and names
+		Arena               m_motion;				// Tracks, packed tracks or keys of every part
+		MappedFile*         m_cache;				// Tracks point into this if opened from a cache
+		std::vector<BVH_Math::vec3> m_rootPath;		// Goes with releaseMotion, compute it again after restoreMotion
 };
 
 #endif
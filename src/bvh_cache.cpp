@@ -0,0 +1,533 @@
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+#include "bvh.h"
+#include "mappedfile.h"
+#include "miniz.h"
+
+/* Binary clip cache (.bvhc)
+ *
+ *   CacheHeader
+ *   CachePart[partCount]
+ *   names          null terminated, referenced by CachePart::name
+ *   rotations      Quaternion[constantRotations], then Quaternion[frames][rotationTracks]
+ *   positions      vec3[constantPositions], then vec3[frames][positionTracks], 16 byte aligned
+ *
+ * The same frame major layout as a loaded clip: tracks that never change are stored once, the
+ * rest one row per frame. Parts without position channels have no position track. Native byte
+ * order; a cache written on another architecture fails the endian check and is rebuilt. Tracks
+ * are used in place from the mapping. */
+
+static const char     cacheMagic[4] = { 'B', 'V', 'H', 'C' };
+static const uint32_t cacheVersion  = 3;
+static const uint32_t cacheEndian   = 0x01020304;
+
+struct CacheHeader {
+
+	char     magic[4];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t quaternionSize;
+	uint64_t sourceSize;
+	int64_t  sourceMtime;
+	uint64_t sourceHash;
+	int32_t  partCount;
+	int32_t  frames;
+	float    frameTime;
+	uint32_t namesSize;
+	uint64_t partsOffset;
+	uint64_t namesOffset;
+	int32_t  rotationTracks;					// Animated tracks, the row length
+	int32_t  positionTracks;
+	uint64_t rotationsOffset;
+	uint64_t positionsOffset;
+	uint64_t fileSize;
+};
+
+struct CachePart {
+
+	int32_t parent;
+	int32_t channels;
+	int32_t childCount;
+	int32_t name;								// Offset into names, or -1
+	float   offset[3];
+	float   end[3];
+	int32_t rotationStride;						// rotationTracks, or 0 if constant
+	int32_t positionStride;						// positionTracks, or 0 if constant
+	uint64_t rotationOffset;					// Frame 0 from the start of the file
+	uint64_t positionOffset;					// 0 if the part has no position track
+};
+
+static inline uint64_t align (uint64_t v, uint64_t a) { return (v + a - 1) & ~(a - 1); }
+
+uint64_t BVH::hash (const char* data, size_t length) {
+
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ length;
+	size_t   i = 0;
+
+	for (; i + 8 <= length; i += 8) {			// 8 bytes per step
+
+		uint64_t w;
+		memcpy (&w, data + i, 8);
+		h  = (h ^ w) * 0xFF51AFD7ED558CCDull;
+		h ^= h >> 32;
+	}
+
+	for (; i < length; ++i) {
+
+		h  = (h ^ (unsigned char) data[i]) * 0x100000001B3ull;
+	}
+
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+bool BVH::writeCache (const char* path, const Stamp& stamp) const {
+
+	if (!m_loaded) return false;
+
+	if (m_frames <= 0 || m_partCount <= 0 || !m_parts[0].rotation) return false;
+
+	int rotations, positions, constantRotations, constantPositions;
+
+	countTracks (rotations, positions, constantRotations, constantPositions);
+
+	CacheHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, cacheMagic, 4);
+
+	std::vector<CachePart> parts (m_partCount);
+	std::vector<char>      names;
+
+	header.version         = cacheVersion;
+	header.endian          = cacheEndian;
+	header.quaternionSize  = sizeof (BVH_Math::Quaternion);
+	header.sourceSize      = stamp.size;
+	header.sourceMtime     = stamp.mtime;
+	header.sourceHash      = stamp.hash;
+	header.partCount       = m_partCount;
+	header.frames          = m_frames;
+	header.frameTime       = m_frameTime;
+	header.partsOffset     = sizeof (CacheHeader);
+	header.namesOffset     = header.partsOffset + parts.size() * sizeof (CachePart);
+	header.rotationTracks  = rotations;
+	header.positionTracks  = positions;
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		const Part* part = &m_parts[i];
+
+		parts[i].parent         = part->parent;
+		parts[i].channels       = part->channels;
+		parts[i].childCount     = part->childCount;
+		parts[i].name           = part->name? (int32_t) names.size(): -1;
+		parts[i].offset[0]      = part->offset.x;
+		parts[i].offset[1]      = part->offset.y;
+		parts[i].offset[2]      = part->offset.z;
+		parts[i].end[0]         = part->end.x;
+		parts[i].end[1]         = part->end.y;
+		parts[i].end[2]         = part->end.z;
+		parts[i].rotationStride = part->rotationStride? rotations: 0;
+		parts[i].positionStride = part->position && part->positionStride? positions: 0;
+
+		if (part->name) names.insert (names.end(), part->name, part->name + strlen (part->name) + 1);
+	}
+
+	header.namesSize       = names.size();
+	header.rotationsOffset = align (header.namesOffset + names.size(), 64);
+	header.positionsOffset = align (header.rotationsOffset + (constantRotations + (uint64_t) m_frames * rotations) * sizeof (BVH_Math::Quaternion), 16);
+	header.fileSize        = align (header.positionsOffset + (constantPositions + (uint64_t) m_frames * positions) * sizeof (BVH_Math::vec3), 16);
+
+	int rotationSlot = constantRotations, constantRotation = 0;			// Same slot order as the loader
+	int positionSlot = constantPositions, constantPosition = 0;
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		const Part* part = &m_parts[i];
+		int slot = part->rotationStride? rotationSlot++: constantRotation++;
+
+		parts[i].rotationOffset = header.rotationsOffset + slot * sizeof (BVH_Math::Quaternion);
+		parts[i].positionOffset = 0;
+
+		if (!part->position) continue;
+
+		slot = part->positionStride? positionSlot++: constantPosition++;
+
+		parts[i].positionOffset = header.positionsOffset + slot * sizeof (BVH_Math::vec3);
+	}
+
+	std::vector<BVH_Math::Quaternion> rotationRow (constantRotations > rotations? constantRotations: rotations);
+	std::vector<BVH_Math::vec3>       positionRow (constantPositions > positions? constantPositions: positions);
+
+	std::string temp = std::string (path) + ".tmp";		// Never leave a half written cache behind
+
+	FILE* fp = fopen (temp.c_str(), "wb");
+
+	if (!fp) return false;
+
+	static const char zero[64] = { 0 };
+
+	bool ok = fwrite (&header, sizeof (header), 1, fp) == 1;
+
+	ok = ok && fwrite (&parts[0], sizeof (CachePart), parts.size(), fp) == parts.size();
+	ok = ok && (names.empty() || fwrite (&names[0], 1, names.size(), fp) == names.size());
+	ok = ok && fwrite (zero, 1, header.rotationsOffset - header.namesOffset - names.size(), fp) == header.rotationsOffset - header.namesOffset - names.size();
+
+	for (int f=-1; f<m_frames && ok; ++f) {							// Constants first, then one row per frame
+
+		size_t n = 0;
+
+		for (int i=0; i<m_partCount; ++i) {
+
+			const Part* part = &m_parts[i];
+
+			if ((f < 0) == !part->rotationStride) rotationRow[n++] = part->rotation[f < 0? 0: f * part->rotationStride];
+		}
+
+		ok = !n || fwrite (&rotationRow[0], sizeof (BVH_Math::Quaternion), n, fp) == n;
+	}
+
+	uint64_t written = header.rotationsOffset + (constantRotations + (uint64_t) m_frames * rotations) * sizeof (BVH_Math::Quaternion);
+
+	ok = ok && fwrite (zero, 1, header.positionsOffset - written, fp) == header.positionsOffset - written;
+
+	for (int f=-1; f<m_frames && ok; ++f) {
+
+		size_t n = 0;
+
+		for (int i=0; i<m_partCount; ++i) {
+
+			const Part* part = &m_parts[i];
+
+			if (part->position && (f < 0) == !part->positionStride) positionRow[n++] = part->position[f < 0? 0: f * part->positionStride];
+		}
+
+		ok = !n || fwrite (&positionRow[0], sizeof (BVH_Math::vec3), n, fp) == n;
+	}
+
+	written = header.positionsOffset + (constantPositions + (uint64_t) m_frames * positions) * sizeof (BVH_Math::vec3);
+
+	ok = ok && fwrite (zero, 1, header.fileSize - written, fp) == header.fileSize - written;
+	ok = fclose (fp) == 0 && ok;
+
+	#ifdef WIN32
+	if (ok) remove (path);										// rename does not replace on windows
+	#endif
+
+	if (!ok || rename (temp.c_str(), path) != 0) {
+
+		remove (temp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool BVH::openCache (const char* path, Stamp& stamp) {
+
+	if (m_partCount) return false;								// Only into an empty BVH
+
+	MappedFile* file = new MappedFile();
+
+	if (!file->open (path) || file->size() < sizeof (CacheHeader)) {
+
+		delete file;
+		return false;
+	}
+
+	const char*        base   = file->data();
+	const CacheHeader& header = *(const CacheHeader*) base;
+
+	bool valid = memcmp (header.magic, cacheMagic, 4) == 0 &&
+	             header.version         == cacheVersion &&
+	             header.endian          == cacheEndian &&
+	             header.quaternionSize  == sizeof (BVH_Math::Quaternion) &&
+	             header.fileSize        == file->size() &&
+	             header.partCount       > 0 &&
+	             header.frames          > 0 &&
+	             header.partsOffset     == sizeof (CacheHeader) &&
+	             header.namesOffset     == header.partsOffset + (uint64_t) header.partCount * sizeof (CachePart) &&
+	             header.rotationsOffset >= header.namesOffset + header.namesSize &&
+	             header.positionsOffset >= header.rotationsOffset &&
+	             header.positionsOffset <= header.fileSize;
+
+	const CachePart* parts = (const CachePart*) (base + header.partsOffset);
+	const char*      names = base + header.namesOffset;
+
+	int rotations = 0, positions = 0;
+
+	for (int i=0; valid && i<header.partCount; ++i) {			// Parents first, tracks inside the file
+
+		const CachePart& p = parts[i];
+
+		uint64_t rotationEnd = p.rotationOffset + ((uint64_t) (header.frames-1) * p.rotationStride + 1) * sizeof (BVH_Math::Quaternion);
+		uint64_t positionEnd = p.positionOffset + ((uint64_t) (header.frames-1) * p.positionStride + 1) * sizeof (BVH_Math::vec3);
+
+		valid = (i==0? p.parent == -1: p.parent >= 0 && p.parent < i) &&
+		        (p.rotationStride == 0 || p.rotationStride == header.rotationTracks) &&
+		        (p.positionStride == 0 || p.positionStride == header.positionTracks) &&
+		        p.rotationOffset % 4 == 0 && p.positionOffset % 4 == 0 &&
+		        p.rotationOffset >= header.rotationsOffset && rotationEnd <= header.positionsOffset &&
+		        (p.positionOffset == 0 || (p.positionOffset >= header.positionsOffset && positionEnd <= header.fileSize));
+
+		rotations += p.rotationStride != 0;
+		positions += p.positionOffset && p.positionStride;
+	}
+
+	valid = valid && rotations == header.rotationTracks && positions == header.positionTracks;
+
+	if (!valid) {
+
+		printf ("BVH::openCache: %s is not a valid cache\n", path);
+		delete file;
+		return false;
+	}
+
+	m_frames    = header.frames;
+	m_frameTime = header.frameTime;
+
+	Hierarchy hierarchy;											// Pointer fixups, no parsing
+
+	hierarchy.parts.resize (header.partCount);
+	hierarchy.names.assign (header.partCount, -1);
+
+	for (int i=0; i<header.partCount; ++i) {
+
+		Part& part = hierarchy.parts[i];
+
+		part.index          = i;
+		part.parent         = parts[i].parent;
+		part.channels       = parts[i].channels;
+		part.childCount     = parts[i].childCount;
+		part.offset         = BVH_Math::vec3 (parts[i].offset[0], parts[i].offset[1], parts[i].offset[2]);
+		part.end            = BVH_Math::vec3 (parts[i].end[0], parts[i].end[1], parts[i].end[2]);
+		part.rotation       = (BVH_Math::Quaternion*) (base + parts[i].rotationOffset);
+		part.position       = parts[i].positionOffset? (BVH_Math::vec3*) (base + parts[i].positionOffset): 0;
+		part.rotationStride = parts[i].rotationStride;
+		part.positionStride = parts[i].positionStride;
+		part.packedRotation = 0;
+		part.packedPosition = 0;
+		part.keyCount       = 0;
+		part.keyFrames      = 0;
+		part.keys           = 0;
+		part.name           = 0;
+		part.children       = 0;
+
+		if (parts[i].name >= 0 && (uint32_t) parts[i].name < header.namesSize) {
+
+			size_t len = strnlen (names + parts[i].name, header.namesSize - parts[i].name);
+
+			hierarchy.names[i] = (int) hierarchy.text.size();
+			hierarchy.text.insert (hierarchy.text.end(), names + parts[i].name, names + parts[i].name + len);
+			hierarchy.text.push_back (0);
+		}
+	}
+
+	setHierarchy (hierarchy);
+
+	m_cache  = file;
+	m_loaded = true;
+
+	stamp.size  = header.sourceSize;
+	stamp.mtime = header.sourceMtime;
+	stamp.hash  = header.sourceHash;
+	return true;
+}
+
+/* Motion snapshot (saveMotion), kept in memory while a clip is not on screen
+ *
+ *   MotionHeader
+ *   MotionPart[partCount]  track pointers as offsets into the block, -1 for none
+ *   block                  raw deflate of the block holding the tracks, split into 4 byte planes
+ *
+ * Full, packed and reduced tracks, or the track section of a mapped cache, all live in one block,
+ * so one format covers them. Splitting words into byte planes puts the similar sign and exponent bytes
+ * of neighbouring floats next to each other, which deflate packs tighter and faster. Only meaningful
+ * to the process that wrote it. */
+
+static const char motionMagic[4] = { 'B', 'V', 'H', 'M' };
+
+struct MotionHeader {
+
+	char     magic[4];
+	int32_t  partCount;
+	int32_t  frames;
+	uint32_t reserved;
+	uint64_t blockSize;
+};
+
+struct MotionPart {
+
+	int64_t rotation;
+	int64_t position;
+	int64_t packedRotation;
+	int64_t packedPosition;
+	int64_t keyFrames;
+	int64_t keys;
+	int32_t rotationStride;
+	int32_t positionStride;
+	int32_t keyCount;
+	int32_t reserved;
+	float   packMin[3];
+	float   packScale[3];
+};
+
+static inline int64_t blockOffset (const void* p, const char* block) { return p? (const char*) p - block: -1; }
+
+template<class T> static inline T* blockPointer (int64_t offset, char* block) { return offset < 0? 0: (T*) (block + offset); }
+
+static void splitPlanes (const char* in, size_t size, unsigned char* out) {
+
+	size_t words = size / 4;
+
+	for (size_t i=0; i<words; ++i) {
+
+		out[i]           = in[i*4];
+		out[i + words]   = in[i*4 + 1];
+		out[i + words*2] = in[i*4 + 2];
+		out[i + words*3] = in[i*4 + 3];
+	}
+
+	memcpy (out + words*4, in + words*4, size - words*4);
+}
+
+static void joinPlanes (const unsigned char* in, size_t size, char* out) {
+
+	size_t words = size / 4;
+
+	for (size_t i=0; i<words; ++i) {
+
+		out[i*4]     = in[i];
+		out[i*4 + 1] = in[i + words];
+		out[i*4 + 2] = in[i + words*2];
+		out[i*4 + 3] = in[i + words*3];
+	}
+
+	memcpy (out + words*4, in + words*4, size - words*4);
+}
+
+bool BVH::saveMotion (std::vector<unsigned char>& out) const {
+
+	if (!m_loaded) return false;
+
+	const char* block = m_motion.data();
+	size_t      size  = m_motion.size();
+
+	if (m_cache) {								// Its tracks only, the view keeps the hierarchy
+
+		const CacheHeader* cache = (const CacheHeader*) m_cache->data();
+
+		block = m_cache->data() + cache->rotationsOffset;
+		size  = cache->fileSize - cache->rotationsOffset;
+	}
+
+	if (m_partCount <= 0 || !block) return false;
+
+	MotionHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, motionMagic, 4);
+
+	header.partCount = m_partCount;
+	header.frames    = m_frames;
+	header.blockSize = size;
+
+	size_t head = sizeof (MotionHeader) + m_partCount * sizeof (MotionPart);
+
+	out.assign (head, 0);
+	memcpy (&out[0], &header, sizeof (header));
+
+	MotionPart* parts = (MotionPart*) &out[sizeof (MotionHeader)];
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		const Part* part = &m_parts[i];
+
+		parts[i].rotation       = blockOffset (part->rotation, block);
+		parts[i].position       = blockOffset (part->position, block);
+		parts[i].packedRotation = blockOffset (part->packedRotation, block);
+		parts[i].packedPosition = blockOffset (part->packedPosition, block);
+		parts[i].keyFrames      = blockOffset (part->keyFrames, block);
+		parts[i].keys           = blockOffset (part->keys, block);
+		parts[i].rotationStride = part->rotationStride;
+		parts[i].positionStride = part->positionStride;
+		parts[i].keyCount       = part->keyCount;
+		parts[i].packMin[0]     = part->packMin.x;
+		parts[i].packMin[1]     = part->packMin.y;
+		parts[i].packMin[2]     = part->packMin.z;
+		parts[i].packScale[0]   = part->packScale.x;
+		parts[i].packScale[1]   = part->packScale.y;
+		parts[i].packScale[2]   = part->packScale.z;
+	}
+
+	std::vector<unsigned char> planes (size);
+	splitPlanes (block, size, &planes[0]);
+
+	size_t bound = mz_compressBound (size);
+	out.resize (head + bound);
+
+	mz_uint flags = tdefl_create_comp_flags_from_zip_params (MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+	size_t  n     = tdefl_compress_mem_to_mem (&out[head], bound, &planes[0], size, flags);
+
+	out.resize (n? head + n: 0);
+	return n != 0;
+}
+
+bool BVH::restoreMotion (const unsigned char* data, size_t size) {
+
+	if (size < sizeof (MotionHeader) || m_partCount <= 0) return false;
+
+	MotionHeader header;
+	memcpy (&header, data, sizeof (header));
+
+	size_t head = sizeof (MotionHeader) + m_partCount * sizeof (MotionPart);
+
+	if (memcmp (header.magic, motionMagic, 4) != 0 || header.partCount != m_partCount || header.frames != m_frames || size < head) return false;
+
+	std::vector<MotionPart> parts (m_partCount);
+	memcpy (&parts[0], data + sizeof (MotionHeader), m_partCount * sizeof (MotionPart));
+
+	for (int i=0; i<m_partCount; ++i) {							// Offsets inside the block
+
+		const int64_t* offsets = &parts[i].rotation;
+
+		for (int k=0; k<6; ++k) if (offsets[k] >= (int64_t) header.blockSize) return false;
+	}
+
+	std::vector<unsigned char> planes (header.blockSize);
+
+	if (tinfl_decompress_mem_to_mem (&planes[0], planes.size(), data + head, size - head, 0) != header.blockSize) return false;
+
+	Arena motion;
+	motion.reserve<char> (header.blockSize);
+
+	if (!motion.commit()) return false;
+
+	char* block = motion.allocate<char> (header.blockSize);
+	joinPlanes (&planes[0], header.blockSize, block);
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		Part* part = &m_parts[i];
+
+		part->rotation       = blockPointer<BVH_Math::Quaternion> (parts[i].rotation, block);
+		part->position       = blockPointer<BVH_Math::vec3> (parts[i].position, block);
+		part->packedRotation = blockPointer<PackedQuaternion> (parts[i].packedRotation, block);
+		part->packedPosition = blockPointer<PackedVec3> (parts[i].packedPosition, block);
+		part->keyFrames      = blockPointer<int> (parts[i].keyFrames, block);
+		part->keys           = blockPointer<BVH_Math::Transform> (parts[i].keys, block);
+		part->rotationStride = parts[i].rotationStride;
+		part->positionStride = parts[i].positionStride;
+		part->keyCount       = parts[i].keyCount;
+		part->packMin        = BVH_Math::vec3 (parts[i].packMin[0], parts[i].packMin[1], parts[i].packMin[2]);
+		part->packScale      = BVH_Math::vec3 (parts[i].packScale[0], parts[i].packScale[1], parts[i].packScale[2]);
+	}
+
+	m_motion.swap (motion);
+	delete m_cache;
+	m_cache = 0;
+	m_loaded = true;
+	return true;
+}
@@ -0,0 +1,268 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+#include "bvh.h"
+#include "mappedfile.h"
+
+/* Compact in-memory representations of loaded motion */
+
+static inline float angleBetween (const BVH_Math::Quaternion& a, const BVH_Math::Quaternion& b) {
+
+	BVH_Math::Quaternion r = BVH_Math::Quaternion (-a.x, -a.y, -a.z, a.w) * b;	// acos is too coarse near 1
+
+	return 2.f * atan2 (sqrt (r.x*r.x + r.y*r.y + r.z*r.z), fabs (r.w));
+}
+
+bool BVH::compact (float& rotationError, float& offsetError) {
+
+	rotationError = offsetError = 0;
+
+	if (!m_loaded) return false;
+
+	if (m_frames <= 0 || !m_parts[0].rotation) return false;		// Nothing loaded or already compact
+
+	int rotations, positions, constantRotations, constantPositions;
+
+	countTracks (rotations, positions, constantRotations, constantPositions);
+
+	Arena packed;														// Packed tracks replace the motion block, same layout
+
+	packed.reserve<PackedQuaternion> (constantRotations + (size_t) m_frames * rotations);
+	packed.reserve<PackedVec3>       (constantPositions + (size_t) m_frames * positions);
+
+	if (!packed.commit()) return false;
+
+	PackedQuaternion* packedRotation = packed.allocate<PackedQuaternion> (constantRotations + (size_t) m_frames * rotations);
+	PackedVec3*       packedPosition = packed.allocate<PackedVec3>       (constantPositions + (size_t) m_frames * positions);
+
+	int rotationSlot = constantRotations, constantRotation = 0;
+	int positionSlot = constantPositions, constantPosition = 0;
+
+	std::vector<BVH_Math::Transform> source (m_frames);
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		Part* part = &m_parts[i];
+
+		for (int f=0; f<m_frames; ++f) getTransform (part, f, source[f]);
+
+		const BVH_Math::Quaternion* rotation = part->rotation;
+		const BVH_Math::vec3*       position = part->position;
+
+		int rotationStride = part->rotationStride;						// Constant tracks stay a single entry
+		int positionStride = part->positionStride;
+		int rotationCount  = rotationStride? m_frames: 1;
+		int positionCount  = positionStride? m_frames: 1;
+
+		part->packedRotation = packedRotation + (rotationStride? rotationSlot++: constantRotation++);
+
+		for (int f=0; f<rotationCount; ++f) BVH_Math::packQuaternion (rotation[f*rotationStride], part->packedRotation[f*rotationStride].v);
+
+		if (position) {
+
+			BVH_Math::vec3 lo = position[0];							// Translation range over the clip
+			BVH_Math::vec3 hi = position[0];
+
+			for (int f=1; f<positionCount; ++f) {
+
+				const BVH_Math::vec3& p = position[f*positionStride];
+
+				lo = BVH_Math::vec3 (fmin (lo.x, p.x), fmin (lo.y, p.y), fmin (lo.z, p.z));
+				hi = BVH_Math::vec3 (fmax (hi.x, p.x), fmax (hi.y, p.y), fmax (hi.z, p.z));
+			}
+
+			part->packMin   = lo;
+			part->packScale = (hi - lo) * (1.f / 65535);
+
+			BVH_Math::vec3 inverse (part->packScale.x > 0? 1 / part->packScale.x: 0,
+			                        part->packScale.y > 0? 1 / part->packScale.y: 0,
+			                        part->packScale.z > 0? 1 / part->packScale.z: 0);
+
+			part->packedPosition = packedPosition + (positionStride? positionSlot++: constantPosition++);
+
+			for (int f=0; f<positionCount; ++f) {
+
+				BVH_Math::vec3 p = position[f*positionStride] - lo;
+				uint16_t*      v = part->packedPosition[f*positionStride].v;
+
+				v[0] = (uint16_t) (p.x * inverse.x + 0.5f);
+				v[1] = (uint16_t) (p.y * inverse.y + 0.5f);
+				v[2] = (uint16_t) (p.z * inverse.z + 0.5f);
+			}
+		}
+
+		part->rotation = 0;												// Measure what the views will see
+		part->position = 0;
+
+		for (int f=0; f<m_frames; ++f) {
+
+			BVH_Math::Transform t;
+			getTransform (part, f, t);
+
+			float a = angleBetween (t.rotation, source[f].rotation);
+			float d = (t.offset - source[f].offset).length();
+
+			if (a > rotationError) rotationError = a;
+			if (d > offsetError)   offsetError   = d;
+		}
+	}
+
+	m_motion.swap (packed);												// Full precision tracks go with the local
+
+	delete m_cache;														// Cached tracks no longer referenced
+	m_cache = 0;
+
+	return true;
+}
+
+void BVH::sampleKeys (const Part* part, float frame, BVH_Math::Transform& out, int& cursor) const {
+
+	const int* keyFrames = part->keyFrames;
+	const int  last      = part->keyCount - 1;
+
+	if (cursor < 0 || cursor > last || frame < keyFrames[cursor]) {	// Jumped back, binary search
+
+		int lo = 0, hi = last;
+
+		while (lo < hi) {
+
+			int mid = (lo + hi + 1) / 2;
+
+			if (keyFrames[mid] <= frame) lo = mid;
+			else hi = mid - 1;
+		}
+
+		cursor = lo;
+	}
+
+	while (cursor < last && keyFrames[cursor+1] <= frame) ++cursor;	// Sequential playback steps at most once
+
+	if (cursor == last) { out = part->keys[last]; return; }
+
+	const BVH_Math::Transform& a = part->keys[cursor];
+	const BVH_Math::Transform& b = part->keys[cursor+1];
+
+	float t = (frame - keyFrames[cursor]) / (keyFrames[cursor+1] - keyFrames[cursor]);
+
+	out.offset   = BVH_Math::lerp (a.offset, b.offset, t);
+	out.rotation = BVH_Math::slerp (a.rotation, b.rotation, t);
+}
+
+float BVH::reduce (float angleTolerance, float offsetTolerance, float& rotationError, float& offsetError) {
+
+	rotationError = offsetError = 0;
+
+	if (!m_loaded) return 1;
+
+	if (m_frames <= 0 || !m_parts[0].rotation) return 1;				// Nothing loaded or already reduced
+
+	const float angleScale  = 1 / (angleTolerance  > 1e-6f? angleTolerance:  1e-6f);
+	const float offsetScale = 1 / (offsetTolerance > 1e-6f? offsetTolerance: 1e-6f);
+
+	std::vector<char> keep (m_frames);
+	std::vector<BVH_Math::Transform>  motion (m_frames);
+	std::vector< std::pair<int,int> > segments;
+	std::vector<int> keyFrames;											// Every part's kept frames, back to back
+	std::vector<int> first (m_partCount + 1, 0);
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		Part* part = &m_parts[i];
+
+		for (int f=0; f<m_frames; ++f) getTransform (part, f, motion[f]);
+
+		keep.assign (m_frames, 0);
+		keep[0] = 1;
+
+		if (part->rotationStride || (part->position && part->positionStride)) {	// Constant parts need one key
+
+			keep[m_frames-1] = 1;
+			segments.push_back (std::make_pair (0, m_frames-1));
+		}
+
+		while (!segments.empty()) {										// Split each span at its worst frame
+
+			int a = segments.back().first;
+			int b = segments.back().second;
+			segments.pop_back();
+
+			float worst = 1;
+			int   split = -1;
+
+			for (int f=a+1; f<b; ++f) {
+
+				float t = (float) (f - a) / (b - a);
+
+				BVH_Math::Quaternion r = BVH_Math::slerp (motion[a].rotation, motion[b].rotation, t);
+				BVH_Math::vec3       p = BVH_Math::lerp (motion[a].offset, motion[b].offset, t);
+
+				float e = angleBetween (r, motion[f].rotation) * angleScale;
+				float d = (p - motion[f].offset).length() * offsetScale;
+
+				if (d > e) e = d;
+				if (e > worst) { worst = e; split = f; }
+			}
+
+			if (split < 0) continue;
+
+			keep[split] = 1;
+			segments.push_back (std::make_pair (a, split));
+			segments.push_back (std::make_pair (split, b));
+		}
+
+		for (int f=0; f<m_frames; ++f) if (keep[f]) keyFrames.push_back (f);
+
+		first[i+1] = (int) keyFrames.size();
+	}
+
+	Arena keys;															// Keys replace the motion block
+
+	keys.reserve<int> (keyFrames.size());
+	keys.reserve<BVH_Math::Transform> (keyFrames.size());
+
+	if (!keys.commit()) return 1;
+
+	int*                 frames     = keys.allocate<int> (keyFrames.size());
+	BVH_Math::Transform* transforms = keys.allocate<BVH_Math::Transform> (keyFrames.size());
+
+	memcpy (frames, &keyFrames[0], keyFrames.size() * sizeof (int));
+
+	for (int i=0; i<m_partCount; ++i) {
+
+		Part* part = &m_parts[i];
+
+		for (int f=0; f<m_frames; ++f) getTransform (part, f, motion[f]);
+
+		part->keyCount  = first[i+1] - first[i];
+		part->keyFrames = frames + first[i];
+		part->keys      = transforms + first[i];
+
+		for (int k=0; k<part->keyCount; ++k) part->keys[k] = motion[part->keyFrames[k]];
+
+		part->rotation = 0;
+		part->position = 0;
+
+		int cursor = 0;													// Measure what the views will see
+
+		for (int f=0; f<m_frames; ++f) {
+
+			BVH_Math::Transform t;
+			sampleKeys (part, f, t, cursor);
+
+			float a = angleBetween (t.rotation, motion[f].rotation);
+			float d = (t.offset - motion[f].offset).length();
+
+			if (a > rotationError) rotationError = a;
+			if (d > offsetError)   offsetError   = d;
+		}
+	}
+
+	m_motion.swap (keys);
+
+	delete m_cache;
+	m_cache = 0;
+
+	return (float) keyFrames.size() / ((float) m_frames * m_partCount);
+}
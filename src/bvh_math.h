@@ -2,6 +2,12 @@
 #define _BVH_MATH_
 
 #include <cmath>
+#include <stdint.h>
+
+#if defined(__SSE2__) && !defined(BVH_NO_SIMD)
+#include <emmintrin.h>
+#define BVH_SIMD_EULER
+#endif
 
 /* Math routines to support BVH class */
 
@@ -144,6 +150,73 @@ class BVH_Math {
             return a;
         }
         
+        static inline void packQuaternion (const Quaternion& q, uint16_t* out) {    // Smallest three, 3 x 15 bits + 2 bit index
+            
+            const float c[4] = { q.x, q.y, q.z, q.w };
+            
+            int largest = 0;
+            
+            for (int i=1; i<4; ++i) if (fabs (c[i]) > fabs (c[largest])) largest = i;
+            
+            float sign = c[largest] < 0? -1.f: 1.f;                                 // q and -q are the same rotation
+            
+            for (int i=0, k=0; i<4; ++i) {
+                
+                if (i == largest) continue;
+                
+                float v = (c[i] * sign * 1.41421356f + 1.f) * 0.5f;           // [-1/sqrt2, 1/sqrt2] to [0,1]
+                
+                if (v < 0.f) v = 0.f;
+                if (v > 1.f) v = 1.f;
+                
+                out[k++] = (uint16_t) (v * 32767.f + 0.5f);
+            }
+            
+            out[0] |= (largest >> 1) << 15;
+            out[1] |= (largest & 1) << 15;
+        }
+        
+        static inline Quaternion unpackQuaternion (const uint16_t* in) {
+            
+            const float scale = 0.70710678f * 2.f / 32767.f;
+            
+            int   largest = (in[0] >> 15) << 1 | in[1] >> 15;
+            float a       = (in[0] & 0x7fff) * scale - 0.70710678f;
+            float b       = (in[1] & 0x7fff) * scale - 0.70710678f;
+            float c       = (in[2] & 0x7fff) * scale - 0.70710678f;
+            float d       = 1.f - a*a - b*b - c*c;
+            
+            d = d > 0.f? sqrt (d): 0.f;
+            
+            switch (largest) {
+                
+                case 0:  return Quaternion (d, a, b, c);
+                case 1:  return Quaternion (a, d, b, c);
+                case 2:  return Quaternion (a, b, d, c);
+                default: return Quaternion (a, b, c, d);
+            }
+        }
+        
+        enum RotationOrder { XYZ, XZY, YXZ, YZX, ZXY, ZYX };         // Axis order as listed in CHANNELS
+        
+        /** Convert count Euler angle sets to quaternions, q = first * second * third in the given order,
+         *  with the angles of each axis in its own array. Angles are multiplied by scale (pi/180 for
+         *  degrees). out is written every outStride elements. Four at a time with SSE2; accurate for
+         *  angles below about 8000 radians. */
+        static inline void eulerToQuaternion (RotationOrder order, const float* first, const float* second, const float* third,
+                                              int count, Quaternion* out, int outStride=1, float scale=1.f) {
+            
+            switch (order) {
+                
+                case XYZ: eulerBatch<0,1,2> (first, second, third, count, out, outStride, scale); break;
+                case XZY: eulerBatch<0,2,1> (first, second, third, count, out, outStride, scale); break;
+                case YXZ: eulerBatch<1,0,2> (first, second, third, count, out, outStride, scale); break;
+                case YZX: eulerBatch<1,2,0> (first, second, third, count, out, outStride, scale); break;
+                case ZXY: eulerBatch<2,0,1> (first, second, third, count, out, outStride, scale); break;
+                case ZYX: eulerBatch<2,1,0> (first, second, third, count, out, outStride, scale); break;
+            }
+        }
+        
         static inline void multMatrix (const float* a, const float* b, float* out) {
             
             out[0]  = a[0]*b[0]  + a[4]*b[1]  + a[8]*b[2]  + a[12]*b[3];
@@ -166,6 +239,118 @@ class BVH_Math {
             out[14] = a[2]*b[12] + a[6]*b[13] + a[10]*b[14] + a[14]*b[15];
             out[15] = a[3]*b[12] + a[7]*b[13] + a[11]*b[14] + a[15]*b[15];
         }
+        
+    private:
+        
+        static inline float mul (float a, float b) { return a * b; }        // Shared by the scalar and SIMD paths
+        static inline float add (float a, float b) { return a + b; }
+        static inline float sub (float a, float b) { return a - b; }
+        
+        #ifdef BVH_SIMD_EULER
+        static inline __m128 mul (__m128 a, __m128 b) { return _mm_mul_ps (a, b); }
+        static inline __m128 add (__m128 a, __m128 b) { return _mm_add_ps (a, b); }
+        static inline __m128 sub (__m128 a, __m128 b) { return _mm_sub_ps (a, b); }
+        #endif
+        
+        template<int Axis, class T>
+        static inline void rotateAxis (T& x, T& y, T& z, T& w, T s, T c) {     // q = q * (axis rotation with half angle sine s, cosine c)
+            
+            T nx, ny, nz, nw;
+            
+            switch (Axis) {
+                
+                case 0:  nx = add (mul (w,s), mul (x,c)); ny = add (mul (y,c), mul (z,s)); nz = sub (mul (z,c), mul (y,s)); nw = sub (mul (w,c), mul (x,s)); break;
+                case 1:  nx = sub (mul (x,c), mul (z,s)); ny = add (mul (w,s), mul (y,c)); nz = add (mul (z,c), mul (x,s)); nw = sub (mul (w,c), mul (y,s)); break;
+                default: nx = add (mul (x,c), mul (y,s)); ny = sub (mul (y,c), mul (x,s)); nz = add (mul (w,s), mul (z,c)); nw = sub (mul (w,c), mul (z,s)); break;
+            }
+            
+            x = nx; y = ny; z = nz; w = nw;
+        }
+        
+        template<int A, int B, int C, class T>
+        static inline void eulerCompose (const T* s, const T* c, T zero, T& x, T& y, T& z, T& w) {
+            
+            x = A==0? s[0]: zero;                                           // First axis straight from identity
+            y = A==1? s[0]: zero;
+            z = A==2? s[0]: zero;
+            w = c[0];
+            
+            rotateAxis<B> (x, y, z, w, s[1], c[1]);
+            rotateAxis<C> (x, y, z, w, s[2], c[2]);
+        }
+        
+        #ifdef BVH_SIMD_EULER
+        static inline void sinCos (__m128 v, __m128& sine, __m128& cosine) {  // Cody-Waite reduction to [-pi/4, pi/4], minimax polynomials
+            
+            __m128i j = _mm_cvtps_epi32 (_mm_mul_ps (v, _mm_set1_ps (0.636619772f)));
+            __m128  q = _mm_cvtepi32_ps (j);
+            __m128  r = _mm_sub_ps (v, _mm_mul_ps (q, _mm_set1_ps (1.5703125f)));
+            
+            r = _mm_sub_ps (r, _mm_mul_ps (q, _mm_set1_ps (4.837512969970703125e-4f)));
+            r = _mm_sub_ps (r, _mm_mul_ps (q, _mm_set1_ps (7.54978995489188216e-8f)));
+            
+            __m128 r2 = _mm_mul_ps (r, r);
+            __m128 ps = _mm_add_ps (_mm_mul_ps (_mm_set1_ps (-1.9515295891e-4f), r2), _mm_set1_ps (8.3321608736e-3f));
+            __m128 pc = _mm_add_ps (_mm_mul_ps (_mm_set1_ps (2.443315711809948e-5f), r2), _mm_set1_ps (-1.388731625493765e-3f));
+            
+            ps = _mm_add_ps (_mm_mul_ps (ps, r2), _mm_set1_ps (-1.6666654611e-1f));
+            ps = _mm_add_ps (_mm_mul_ps (_mm_mul_ps (ps, r2), r), r);
+            pc = _mm_add_ps (_mm_mul_ps (pc, r2), _mm_set1_ps (4.166664568298827e-2f));
+            pc = _mm_add_ps (_mm_sub_ps (_mm_mul_ps (_mm_mul_ps (pc, r2), r2), _mm_mul_ps (r2, _mm_set1_ps (0.5f))), _mm_set1_ps (1.f));
+            
+            __m128 swap    = _mm_castsi128_ps (_mm_cmpeq_epi32 (_mm_and_si128 (j, _mm_set1_epi32 (1)), _mm_set1_epi32 (1)));
+            __m128 sinSign = _mm_castsi128_ps (_mm_slli_epi32 (_mm_and_si128 (j, _mm_set1_epi32 (2)), 30));
+            __m128 cosSign = _mm_castsi128_ps (_mm_slli_epi32 (_mm_and_si128 (_mm_add_epi32 (j, _mm_set1_epi32 (1)), _mm_set1_epi32 (2)), 30));
+            
+            sine   = _mm_xor_ps (_mm_or_ps (_mm_and_ps (swap, pc), _mm_andnot_ps (swap, ps)), sinSign);
+            cosine = _mm_xor_ps (_mm_or_ps (_mm_and_ps (swap, ps), _mm_andnot_ps (swap, pc)), cosSign);
+        }
+        #endif
+        
+        template<int A, int B, int C>
+        static void eulerBatch (const float* a, const float* b, const float* c, int count, Quaternion* out, int outStride, float scale) {
+            
+            const float half = scale * 0.5f;
+            int i = 0;
+            
+            #ifdef BVH_SIMD_EULER
+            const __m128 h = _mm_set1_ps (half);
+            
+            for (; i + 4 <= count; i += 4) {
+                
+                __m128 e[3] = { _mm_loadu_ps (a + i), _mm_loadu_ps (b + i), _mm_loadu_ps (c + i) };
+                
+                __m128 sine[3], cosine[3];
+                
+                for (int k=0; k<3; ++k) sinCos (_mm_mul_ps (e[k], h), sine[k], cosine[k]);
+                
+                __m128 x, y, z, w;
+                
+                eulerCompose<A,B,C> (sine, cosine, _mm_setzero_ps(), x, y, z, w);
+                
+                _MM_TRANSPOSE4_PS (x, y, z, w);                             // Now one quaternion per register
+                
+                _mm_storeu_ps (&out->x, x); out += outStride;
+                _mm_storeu_ps (&out->x, y); out += outStride;
+                _mm_storeu_ps (&out->x, z); out += outStride;
+                _mm_storeu_ps (&out->x, w); out += outStride;
+            }
+            #endif
+            
+            for (; i < count; ++i, out += outStride) {
+                
+                const float angle[3] = { a[i], b[i], c[i] };
+                float s[3], cs[3];
+                
+                for (int k=0; k<3; ++k) {
+                    
+                    s[k]  = sin (angle[k] * half);
+                    cs[k] = cos (angle[k] * half);
+                }
+                
+                eulerCompose<A,B,C> (s, cs, 0.f, out->x, out->y, out->z, out->w);
+            }
+        }
 };
 
 #endif
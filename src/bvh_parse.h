@@ -0,0 +1,188 @@
+#ifndef _BVH_PARSE_
+#define _BVH_PARSE_
+
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#if defined(__SSE2__) && !defined(BVH_NO_SIMD)
+#include <emmintrin.h>
+#define BVH_SIMD_DIGITS
+#endif
+
+/* Bounded text tokenizer for the BVH grammar. None of these read past end. */
+
+inline void whitespace (const char*& s, const char* end) {
+
+	while (s<end && (*s==' ' || *s=='\t' || *s=='\n' || *s=='\r')) ++s;
+}
+
+inline void nextLine (const char*& s, const char* end) {
+
+	while (s<end && *s != '\n' && *s != '\r') ++s;
+	whitespace (s, end);
+}
+
+inline bool word (const char*& s, const char* end, const char* key, int len) {
+
+	if (end-s < len || strncmp (s, key, len) != 0) return false;
+	s += len;
+	return true;
+}
+
+inline bool isDigit (char c) { return (unsigned char)(c - '0') < 10; }
+
+inline const char* digitRun (const char* s, const char* end) {	// End of a run of decimal digits
+
+	#ifdef BVH_SIMD_DIGITS
+	while (end - s >= 16) {										// 16 characters at a time
+
+		__m128i v    = _mm_loadu_si128 ((const __m128i*) s);
+		__m128i t    = _mm_sub_epi8 (v, _mm_set1_epi8 ('0' + (char)0x80));
+		__m128i lt   = _mm_cmplt_epi8 (t, _mm_set1_epi8 ((char)(0x80 + 10)));	// Unsigned c-'0' < 10
+		unsigned bit = ~_mm_movemask_epi8 (lt) & 0xffff;
+
+		if (bit) return s + __builtin_ctz (bit);
+		s += 16;
+	}
+	#endif
+
+	while (s<end && isDigit (*s)) ++s;
+	return s;
+}
+
+inline uint32_t eightDigits (const char* s) {					// SWAR conversion of 8 ascii digits (little endian)
+
+	uint64_t v;
+	memcpy (&v, s, 8);
+	v -= 0x3030303030303030ull;
+	v  = (v * 10) + (v >> 8);
+	v  = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+	      (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+	return (uint32_t) v;
+}
+
+inline const char* accumulate (const char* s, const char* run, uint64_t& mantissa, int& digits) {
+
+	if (!digits) while (s<run && *s=='0') ++s;					// Leading zeros are not significant
+
+	while (run - s >= 8 && digits <= 11) {						// Room for 8 more digits in 19
+		mantissa = mantissa * 100000000 + eightDigits (s);
+		digits  += 8;
+		s       += 8;
+	}
+
+	for (; s<run && digits<19; ++s, ++digits) mantissa = mantissa * 10 + (*s - '0');
+
+	return s;													// Any digits left over did not fit
+}
+
+inline bool isNumber (char c) { return isDigit (c) || c=='-' || c=='+' || c=='.' || c=='e' || c=='E'; }
+
+inline bool slowFloat (const char*& data, const char* end, float& out) {	// Rare forms go through strtod
+
+	char buffer[64];
+	int  len = 0;
+
+	while (data+len<end && len<63 && isNumber (data[len])) {
+		buffer[len] = data[len];
+		++len;
+	}
+
+	if (data+len<end && isNumber (data[len])) return false;		// Too long to copy, never split it in two
+
+	buffer[len] = 0;
+
+	char* stop;
+	out = strtod (buffer, &stop);
+
+	if (stop == buffer) return false;
+
+	data += stop - buffer;
+	return true;
+}
+
+inline bool readFloat (const char*& data, const char* end, float& out) {
+
+	static const double power[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	whitespace (data, end);
+
+	const char* s   = data;
+	bool negative   = false;
+
+	if (s<end && (*s=='-' || *s=='+')) negative = *s++ == '-';
+
+	uint64_t mantissa = 0;
+	int digits   = 0;
+	int exponent = 0;
+
+	const char* run = digitRun (s, end);						// Integer part
+	const char* r   = accumulate (s, run, mantissa, digits);
+
+	exponent += run - r;										// Dropped integer digits still count
+	bool any  = run > s;
+	s         = run;
+
+	if (s<end && *s=='.') {										// Fraction
+
+		run = digitRun (++s, end);
+		r   = accumulate (s, run, mantissa, digits);
+
+		exponent -= r - s;
+		any      |= run > s;
+		s         = run;
+	}
+
+	if (!any) return false;
+
+	if (s<end && (*s=='e' || *s=='E')) {						// Exponent
+
+		const char* e = s + 1;
+		bool eneg     = false;
+
+		if (e<end && (*e=='-' || *e=='+')) eneg = *e++ == '-';
+
+		if (e<end && isDigit (*e)) {
+
+			int value = 0;
+
+			for (; e<end && isDigit (*e); ++e) if (value < 10000) value = value*10 + (*e - '0');
+
+			exponent += eneg? -value: value;
+			s         = e;
+		}
+	}
+
+	if (mantissa >> 53 || exponent < -22 || exponent > 22) return slowFloat (data, end, out);
+
+	double value = (double) mantissa;							// Exact for mantissa < 2^53 and |exponent| <= 22
+
+	value = exponent < 0? value / power[-exponent]: value * power[exponent];
+	out   = (float) (negative? -value: value);
+	data  = s;
+	return true;
+}
+
+inline bool readInt (const char*& data, const char* end, int& out) {
+
+	whitespace (data, end);
+
+	const char* s = data;
+	bool negative = false;
+
+	if (s<end && (*s=='-' || *s=='+')) negative = *s++ == '-';
+
+	if (s>=end || !isDigit (*s)) return false;
+
+	int value = 0;
+
+	for (; s<end && isDigit (*s); ++s) value = value*10 + (*s - '0');
+
+	out  = negative? -value: value;
+	data = s;
+	return true;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include "bvh.h"
+#include "bvh_parse.h"
+
+/* Streamed loading, for text that is produced as it is parsed. Only a window of it is held: the
+ * header has to fit whole, then frame lines are parsed a batch at a time and the unparsed tail is
+ * moved to the front before every refill. A header or line longer than the window grows it. */
+
+BVH::Stream::Stream (ReadFunction read, void* user, std::vector<char>& window) :
+	read(read), user(user), window(&window), begin(0), end(0), finished(false) {
+
+	if (window.size() < 4096) window.resize (4096);
+}
+
+bool BVH::Stream::fill() {
+
+	if (finished) return false;
+
+	std::vector<char>& text = *window;
+
+	if (begin > 0) {							// Unparsed tail to the front
+
+		memmove (&text[0], &text[begin], end - begin);
+		end  -= begin;
+		begin = 0;
+	}
+
+	if (end == text.size()) text.resize (text.size() * 2);	// One piece fills it all
+
+	size_t size = read (user, &text[end], text.size() - end);
+
+	end     += size;
+	finished = size == 0;
+
+	return size > 0;
+}
+
+bool BVH::openStream (Stream& stream) {
+
+	static const char key[] = "Frame Time:";	// The header ends with this line
+	const size_t keyLength  = sizeof (key) - 1;
+	size_t searched = 0;
+
+	for (;;) {
+
+		const char* text  = &(*stream.window)[0];
+		const char* end   = text + stream.end;
+		const char* start = text + (searched > keyLength? searched - keyLength: 0);
+		const char* found = std::search (start, end, key, key + keyLength);
+
+		if (found != end && memchr (found, '\n', end - found)) break;
+
+		searched = stream.end;
+
+		if (!stream.fill()) break;				// Parse what there is
+	}
+
+	const char* text = &(*stream.window)[0];
+	const char* data = text + stream.begin;
+
+	m_source    = 0;							// Nothing for loadFrames, the text goes with the window
+	m_sourceEnd = 0;
+	m_loaded    = false;
+
+	if (!readHeader (data, text + stream.end)) return false;
+
+	stream.begin = data - text;
+
+	return m_frames > 0;
+}
+
+bool BVH::loadStream (Stream& stream) {
+
+	const int batch = 64;						// Frames tokenized before decoding, one column per channel
+
+	int capacity = m_frames < 4096? m_frames: 4096;	// Grown as lines arrive, never trusting the header's count
+
+	if (!m_partCount || m_frames <= 0 || !allocateFrames (capacity)) return false;
+
+	std::vector<float> values ((size_t) m_channelCount * batch + 1);
+
+	int frame = 0;
+
+	while (frame < m_frames) {
+
+		if (cancelled()) return false;			// Checkpoint, every batch of frames
+
+		if (frame + batch > capacity && capacity < m_frames) {
+
+			capacity = capacity < m_frames / 2? capacity * 2: m_frames;
+
+			if (!allocateFrames (capacity, frame)) return false;
+		}
+
+		int  count = 0;
+		bool ended = false;
+
+		while (count < batch && frame + count < m_frames) {
+
+			const char* text = &(*stream.window)[0];
+			const char* end  = text + stream.end;
+			const char* line = text + stream.begin;
+
+			whitespace (line, end);				// Also skips blank lines
+			stream.begin = line - text;
+
+			const char* eol = (const char*) memchr (line, '\n', end - line);
+
+			if (!eol && stream.fill()) continue;	// Window moved, look again
+
+			if (line == end) { ended = true; break; }
+
+			const char* next = eol? eol + 1: end;
+
+			if (!readFrame (line, next, &values[count], batch)) {
+
+				if (eol || !stream.finished) {
+
+					printf ("BVH::loadStream: Frame %d has too few values\n", frame + count);
+					return false;
+				}
+
+				printf ("BVH::loadStream: Dropping incomplete frame %d\n", frame + count);
+				stream.begin = stream.end;
+				ended = true;
+				break;
+			}
+
+			stream.begin = next - text;
+			++count;
+		}
+
+		decodeFrames (frame, count, &values[0], batch);
+		frame += count;
+
+		if (ended) break;
+	}
+
+	if (frame != m_frames) {					// Truncated capture
+
+		printf ("BVH::loadStream: Expected %d frames, found %d\n", m_frames, frame);
+		m_frames = frame;
+
+		if (frame > 0 && frame < capacity) allocateFrames (frame, frame);	// Trimmed, or left as it is without the memory to
+	}
+
+	const char* text = &(*stream.window)[0] + stream.begin;
+
+	whitespace (text, &(*stream.window)[0] + stream.end);
+
+	if (text < &(*stream.window)[0] + stream.end) printf ("BVH::loadStream: Ignoring data after frame %d\n", m_frames);
+
+	m_loaded = true;
+
+	shareConstantTracks();
+
+	return m_frames > 0;
+}
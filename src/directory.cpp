@@ -96,3 +96,14 @@ bool isDirectory (const char* path) {
 	stat (path, &st);
 	return S_ISDIR (st.st_mode);
 }
+
+bool getFileInfo (const char* path, size_t* size, long long* mtime) {
+
+	struct stat st;
+
+	if (stat (path, &st) != 0) return false;
+
+	if (size)  *size  = st.st_size;
+	if (mtime) *mtime = st.st_mtime;
+	return true;
+}
@@ -2,6 +2,7 @@
 #define _DIRECTORY_
 
 #include <vector>
+#include <cstddef>
 
 /** Directory class for listing files in a directory */
 
@@ -33,6 +34,7 @@ class Directory {
 };
 
 bool isDirectory(const char* path);
+bool getFileInfo(const char* path, size_t* size, long long* mtime);		// false if path does not exist
 
 #endif
 
@@ -0,0 +1,73 @@
+#ifndef _FREELIST_
+#define _FREELIST_
+
+#include <vector>
+#include "thread.h"
+
+/** Objects handed back for reuse instead of deleted, shared between threads. Whatever an object
+ *  holds when given back stays with it, so buffers keep their capacity for the next taker. */
+
+template<class T>
+class FreeList {
+
+	public:
+
+		FreeList() : m_limit(16) {}
+
+		~FreeList() {
+
+			for (size_t i=0; i<m_items.size(); ++i) delete m_items[i];
+		}
+
+		void setLimit (size_t count) {							/** Kept at most, the rest are deleted */
+
+			base::MutexLock lock (m_lock);
+
+			m_limit = count;
+			m_items.reserve (count);							// Giving back never allocates
+		}
+
+		T* take() {												/** A spare one, or a new one when there is none */
+
+			{
+				base::MutexLock lock (m_lock);
+
+				if (!m_items.empty()) {
+
+					T* item = m_items.back();
+					m_items.pop_back();
+					return item;
+				}
+			}
+
+			return new T();
+		}
+
+		void give (T* item) {
+
+			if (!item) return;
+
+			{
+				base::MutexLock lock (m_lock);
+
+				if (m_items.size() < m_limit) {
+
+					m_items.push_back (item);
+					return;
+				}
+			}
+
+			delete item;
+		}
+
+	private:
+
+		FreeList (const FreeList&);								// Not copyable
+		FreeList& operator= (const FreeList&);
+
+		base::Mutex     m_lock;
+		std::vector<T*> m_items;
+		size_t          m_limit;
+};
+
+#endif
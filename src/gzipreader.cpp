@@ -0,0 +1,179 @@
+#include "gzipreader.h"
+#include <cstring>
+
+GzipReader::GzipReader() : m_status(TINFL_STATUS_FAILED), m_data(0), m_in(0), m_end(0), m_next(0), m_pending(0), m_crc(MZ_CRC32_INIT), m_length(0), m_position(0) {}
+
+bool GzipReader::open (const char* data, size_t size) {
+
+	const mz_uint8* in  = (const mz_uint8*) data;
+	const mz_uint8* end = in + size;
+
+	m_status = TINFL_STATUS_FAILED;
+
+	if (size < 18 || !(in = header (in, end))) return false;	// Header and trailer at least
+
+	tinfl_init (&m_inflator);
+
+	m_status   = TINFL_STATUS_NEEDS_MORE_INPUT;				// Nothing inflated yet
+	m_data     = (const mz_uint8*) data;
+	m_in       = in;
+	m_end      = end;
+	m_next     = 0;
+	m_pending  = 0;
+	m_crc      = MZ_CRC32_INIT;
+	m_length   = 0;
+	m_position = 0;
+	return true;
+}
+
+const mz_uint8* GzipReader::header (const mz_uint8* in, const mz_uint8* end) {
+
+	enum { TEXT=1, HEADER_CRC=2, EXTRA=4, NAME=8, COMMENT=16 };
+
+	if (end - in < 10 || in[0] != 0x1f || in[1] != 0x8b || in[2] != 8) return 0;	// Deflate only
+
+	int flags = in[3];
+
+	in += 10;													// Past the time, extra flags and system
+
+	if (flags & EXTRA) {
+
+		if (end - in < 2) return 0;
+
+		size_t length = in[0] | in[1] << 8;
+
+		if ((size_t) (end - in) < length + 2) return 0;
+
+		in += length + 2;
+	}
+
+	if (flags & NAME)    { in = (const mz_uint8*) memchr (in, 0, end - in); if (!in) return 0; ++in; }
+	if (flags & COMMENT) { in = (const mz_uint8*) memchr (in, 0, end - in); if (!in) return 0; ++in; }
+	if (flags & HEADER_CRC) in += 2;
+
+	return in <= end? in: 0;
+}
+
+bool GzipReader::trailer() const {
+
+	if (m_end - m_in < 8) return false;
+
+	mz_uint32 crc    = m_in[0] | m_in[1] << 8 | m_in[2] << 16 | (mz_uint32) m_in[3] << 24;
+	mz_uint32 length = m_in[4] | m_in[5] << 8 | m_in[6] << 16 | (mz_uint32) m_in[7] << 24;
+
+	return crc == (mz_uint32) m_crc && length == m_length;
+}
+
+bool GzipReader::nextMember() {
+
+	if (!trailer()) { m_status = TINFL_STATUS_FAILED; return false; }	// Corrupt, read no further
+
+	const mz_uint8* in = header (m_in + 8, m_end);
+
+	if (!in) return false;										// The last one, left done
+
+	tinfl_init (&m_inflator);
+
+	m_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+	m_in     = in;
+	m_crc    = MZ_CRC32_INIT;
+	m_length = 0;
+	return true;
+}
+
+size_t GzipReader::read (char* buffer, size_t size) {
+
+	return take (buffer, size);
+}
+
+mz_uint64 GzipReader::skip (mz_uint64 size) {
+
+	mz_uint64 done = 0;
+
+	while (done < size) {
+
+		size_t n = take (0, (size_t) (size - done < (1u << 30)? size - done: (1u << 30)));
+
+		if (!n) break;
+
+		done += n;
+	}
+
+	return done;
+}
+
+size_t GzipReader::take (char* buffer, size_t size) {
+
+	size_t done = 0;
+
+	while (done < size) {
+
+		if (m_pending) {										// Inflated, not read yet
+
+			size_t n = m_pending < size - done? m_pending: size - done;
+
+			if (buffer) memcpy (buffer + done, m_dict + m_next - m_pending, n);
+			m_pending -= n;
+			done      += n;
+
+			if (!m_pending && m_next == TINFL_LZ_DICT_SIZE) m_next = 0;
+
+			continue;
+		}
+
+		if (m_status == TINFL_STATUS_DONE && !nextMember()) break;	// Concatenated members read as one
+		if (m_status < 0) break;
+
+		size_t in  = m_end - m_in;								// All of the input is there, so no more input flag
+		size_t out = TINFL_LZ_DICT_SIZE - m_next;
+
+		m_status = tinfl_decompress (&m_inflator, m_in, &in, m_dict, m_dict + m_next, &out, 0);
+
+		m_crc     = mz_crc32 (m_crc, m_dict + m_next, out);
+		m_length += (mz_uint32) out;
+		m_in     += in;
+		m_next   += out;
+		m_pending = out;
+
+		if (!out && m_status != TINFL_STATUS_DONE && m_status >= 0) m_status = TINFL_STATUS_FAILED;	// Stuck, never loop
+	}
+
+	m_position += done;
+	return done;
+}
+
+void GzipReader::save (Checkpoint& out) const {
+
+	out.in       = m_in - m_data;
+	out.out      = m_position;
+	out.next     = (mz_uint32) m_next;
+	out.pending  = (mz_uint32) m_pending;
+	out.crc      = (mz_uint32) m_crc;
+	out.length   = m_length;
+	out.status   = m_status;
+	out.inflator = m_inflator;
+
+	memcpy (out.dict, m_dict, sizeof (m_dict));
+}
+
+bool GzipReader::restore (const Checkpoint& from) {
+
+	if (!m_data || from.in > (mz_uint64) (m_end - m_data) || from.next > TINFL_LZ_DICT_SIZE || from.pending > from.next) return false;
+
+	m_in       = m_data + from.in;
+	m_position = from.out;
+	m_next     = from.next;
+	m_pending  = from.pending;
+	m_crc      = from.crc;
+	m_length   = from.length;
+	m_status   = (tinfl_status) from.status;
+	m_inflator = from.inflator;
+
+	memcpy (m_dict, from.dict, sizeof (m_dict));
+	return true;
+}
+
+bool GzipReader::intact() const {
+
+	return m_status == TINFL_STATUS_DONE && !m_pending && trailer() && m_end - m_in == 8;	// Nothing after the last member
+}
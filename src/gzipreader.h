@@ -0,0 +1,67 @@
+#ifndef _GZIPREADER_
+#define _GZIPREADER_
+
+#include <cstddef>
+#include "miniz.h"
+
+/** Gzip file inflated a piece at a time out of memory, such as a mapped .gz file. Members written
+ *  one after another, as by concatenation or a parallel compressor, read as one stream. Output goes
+ *  through the 32k deflate dictionary, so that is all that is held however large the text is.
+ *  A checkpoint is the inflater's whole state at some point; restored into a reader of the same
+ *  data, it goes on from there without inflating anything before it. */
+
+class GzipReader {
+
+	public:
+
+		struct Checkpoint {
+
+			mz_uint64          in;								// Deflated bytes read, from the start of the data
+			mz_uint64          out;								// Inflated bytes read
+			mz_uint32          next;
+			mz_uint32          pending;
+			mz_uint32          crc;
+			mz_uint32          length;
+			int                status;
+			tinfl_decompressor inflator;						// Plain data, no pointers
+			mz_uint8           dict[TINFL_LZ_DICT_SIZE];
+		};
+
+		GzipReader();
+
+		bool      open (const char* data, size_t size);			/** Read the first member header, false if it is not gzip */
+		size_t    read (char* buffer, size_t size);				/** Next inflated bytes, 0 at the end or on an error */
+		mz_uint64 skip (mz_uint64 size);						/** Inflate past bytes, how many it got past */
+		bool      intact() const;								/** Read to the end, every trailer matched and nothing follows the last */
+		mz_uint64 position() const { return m_position; }		/** Inflated bytes read or skipped */
+
+		void save (Checkpoint& out) const;						/** Where the reader is now */
+		bool restore (const Checkpoint& from);					/** Go back or on to a checkpoint of the same data, once open */
+
+		static size_t read (void* reader, char* buffer, size_t size) { return ((GzipReader*) reader)->read (buffer, size); }
+
+	private:
+
+		size_t take (char* buffer, size_t size);				// Read, or skip with no buffer
+		bool   trailer() const;									// The member just inflated matches its trailer
+		bool   nextMember();									// On past the trailer, false at the end or on an error
+
+		static const mz_uint8* header (const mz_uint8* in, const mz_uint8* end);	// Past a member header, or null
+
+		GzipReader (const GzipReader&);							// Not copyable
+		GzipReader& operator= (const GzipReader&);
+
+		tinfl_decompressor m_inflator;
+		tinfl_status       m_status;
+		const mz_uint8*    m_data;								// What was opened, checkpoints count from it
+		const mz_uint8*    m_in;								// Next deflated byte
+		const mz_uint8*    m_end;
+		mz_uint8           m_dict[TINFL_LZ_DICT_SIZE];			// Inflated into, wrapping
+		size_t             m_next;								// Where the dictionary is written next
+		size_t             m_pending;							// Inflated bytes before m_next not yet read
+		mz_ulong           m_crc;
+		mz_uint32          m_length;							// Inflated so far, modulo 2^32 as in the trailer
+		mz_uint64          m_position;
+};
+
+#endif
@@ -4,10 +4,19 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <algorithm>
 
 #include "view.h"
 #include "thread.h"
+#include "workpool.h"
+#include "mpscqueue.h"
+#include "freelist.h"
+#include "zippool.h"
+#include "tarpool.h"
 #include "directory.h"
+#include "mappedfile.h"
+#include "gzipreader.h"
+#include "bench.h"
 
 #include "miniz.c"
 
@@ -17,14 +26,53 @@ struct FileEntry {
 
 	std::string directory;				// Directory
 	std::string name;					// File name
-	std::string archive;				// Directory is a zip file
-	int         zipIndex;				// Index of file in archive
+	std::string archive;				// Directory is a zip or tar file
+	int         archiveId;				// Of the archive in app.zips, -1 if none
+	int         tarId;					// Of the archive in app.tars, -1 if none
+	int         entryIndex;				// Index of file in archive
 };
 
+enum LoadKind { LOAD, PROMOTE, DEMOTE };
+
+typedef std::vector<unsigned char> Snapshot;	// BVH::saveMotion output
+typedef std::vector<char>          Buffer;		// Bytes of a file between loading stages
+
 struct LoadRequest {
 
 	FileEntry 	file;					// File to load
 	View*     	view;					// Target view
+	int         index;					// Of the view and file
+	LoadKind    kind;					// Load from disk, restore from a snapshot or take one
+	BVH*        bvh;					// The view's clip, for PROMOTE and DEMOTE, else once parsed
+	const Snapshot* warm;				// Restored by PROMOTE
+
+	MappedFile* content;				// Plain file, mapped and read by the read stage
+	const char* entry;					// Zip entry as stored, in the archive's mapping
+	size_t      entrySize;
+	Buffer*     data;					// Zip entry once inflated
+	bool        deflated;
+	bool        streamed;				// Large zip entry, .gz file or .tar.gz entry, inflated by the parser as it goes
+	BVH::Stamp  stamp;					// Source identity, a zip entry's crc is its hash
+	std::string cache;					// .bvhc to write once parsed, empty if not
+};
+
+struct Completion {
+
+	int         index;					// View the clip is for
+	BVH*        bvh;					// Replaces the view's clip unless already there, may be null
+	View::State state;					// New view state
+	LoadKind    kind;					// PROMOTE only if the snapshot was restored
+	Snapshot*   warm;					// Taken by DEMOTE, null if that failed
+};
+
+struct CacheStats {
+
+	unsigned    hotHits;				// Came back on screen still loaded
+	unsigned    warmHits;				// Requested with a snapshot in memory
+	unsigned    misses;					// Requested from disk
+	unsigned    promotions;				// Snapshots restored
+	unsigned    demotions;				// Clips unloaded to a snapshot
+	unsigned    warmEvictions;			// Snapshots dropped for space
 };
 
 enum AppMode { VIEW_SINGLE, VIEW_TILES };
@@ -38,18 +86,58 @@ struct App {
 	int 		tileSize;				// Tile size for tiled view
 	int         activeIndex;			// Current single mode view index
 	int         scrollOffset;			// Scroll offset in tile view
+	int         direction;				// Browsing towards later files (1) or earlier ones (-1)
 	int 		width, height;			// Window size
 
 	std::vector<View*> 		 views;		// An array of all views
 	std::set<std::string> 	 paths;		// Set of unique Directories
 	std::vector<FileEntry> 	 files;		// Array of all bvh files found
-	std::vector<LoadRequest> loadQueue;	// Queue of views to be loaded
 
-	base::Thread loadThread;			// Loading thread
-	base::Mutex  loadMutex;				// Loading mutex
+	WorkPool<LoadRequest> loader;		// Read stage, its queue is ranked and trimmed every frame
+	WorkPool<LoadRequest> inflater;		// Zip entries, and snapshots taken or restored
+	WorkPool<LoadRequest> parser;
+	WorkPool<LoadRequest> finisher;		// Cache writes, reduction, compaction and framing
+	MPSCQueue<Completion> completed;	// Loader results, applied by the main loop
+	FreeList<Buffer>     buffers;		// Given back once parsed, so loading stops allocating
+	FreeList<MappedFile> mappings;
+	FreeList<BVH>        spareClips;	// Dropped clips, reset for the parser to open the next one in
+	ZipPool      zips;					// Archives stay open, their directories parsed once
+	TarPool      tars;					// Likewise, indexed once and the index kept
+	int          readers;				// Workers per stage
+	int          inflaters;
+	int          parsers;
+	int          finishers;
+	int          stageQueue;			// Jobs waiting at a stage before the one feeding it waits, 0 for twice its workers
+	int          parseThreads;			// Threads each parser splits a clip's frames across
+	std::vector<float> priority;		// Per view load priority, refreshed every frame
+	std::vector<unsigned> lastSeen;		// Per view, frame it was last on screen
+	std::vector<size_t>   memory;		// Per view, bytes counted in memoryUsed
+	unsigned     frame;					// Main loop iterations
+
+	size_t       memoryBudget;			// Bytes of loaded clips to keep, 0 for no limit
+	size_t       memoryUsed;
+	bool         keepSkeletons;			// Evict to the hierarchy instead of nothing
+
+	std::vector<Snapshot*> warm;		// Per view motion of an unloaded clip, the view keeps its hierarchy
+	std::vector<char>     demoting;		// Per view, a DEMOTE job is in flight
+	size_t       warmBudget;			// Bytes of snapshots to keep, 0 to unload straight to disk
+	size_t       warmUsed;
+	CacheStats   stats;
+
+	bool         cache;					// Use .bvhc clip caches
+	std::string  cacheDir;				// Where caches go, next to the source if empty
+	bool         compact;				// Quantise loaded clips
+	float        reduceAngle;			// Keyframe reduction tolerance in degrees, off if negative
+	float        reduceOffset;			// and in units
 
 } app;
 
+const float queueDistance = 1;					// Screens of prefetch around the window
+const float dropDistance  = 2;					// Queued or loading views further out are given up
+const size_t spareBytes   = 4 << 20;			// Largest buffer or clip block kept for reuse
+const size_t streamBytes  = 1 << 20;			// Larger zip entries are inflated into the parser a window at a time
+const size_t streamWindow = 256 << 10;
+
 // -------------------------------------------------------------------------------------- //
 
 inline bool endsWith (const char* s, const char* end) {
@@ -60,6 +148,23 @@ inline bool endsWith (const char* s, const char* end) {
 	return sl >= el && strcmp (s+sl-el, end) == 0;
 }
 
+inline bool isClip (const char* name) {		// Plain or gzipped text
+
+	return endsWith (name, ".bvh") || endsWith (name, ".bvh.gz");
+}
+
+inline bool isTar (const char* name) {			// Plain or gzipped
+
+	return endsWith (name, ".tar") || endsWith (name, ".tar.gz") || endsWith (name, ".tgz");
+}
+
+inline int workerCount (const char* arg) {
+
+	int n = atoi (arg);
+
+	return n < 1? 1: n;
+}
+
 inline const char* getName (const char* path) {
 
 	const char* c = strrchr (path, '/');
@@ -86,6 +191,8 @@ void addFile (const char* f) {
 	
 	file.name		= getName (f);
 	file.directory	= getDirectory (f);
+	file.archiveId	= -1;
+	file.tarId		= -1;
 
 	app.files.push_back (file);
 
@@ -94,11 +201,10 @@ void addFile (const char* f) {
 
 int addZip (const char* f) {
 
+	int archive = app.zips.open (f);			// Kept open, loads read entries from it
 	mz_zip_archive zipFile;
-	memset (&zipFile, 0, sizeof (zipFile));
-	mz_bool status = mz_zip_reader_init_file (&zipFile, f, 0);
 
-	if (!status) {
+	if (!app.zips.reader (archive, zipFile)) {
 
 		printf ("Failed to open zip file %s\n", f);
 		return -1;
@@ -108,19 +214,21 @@ int addZip (const char* f) {
 
 	for (int i=0; i<files; ++i) {
 
-		mz_zip_archive_file_stat stat;
+		char name[1024];						// Names only, a full stat converts every timestamp
 
-		if (mz_zip_reader_file_stat (&zipFile, i, &stat)) {
+		if (mz_zip_reader_get_filename (&zipFile, i, name, sizeof (name))) {
 
-			if (endsWith (stat.m_filename, ".bvh") ) {
+			if (endsWith (name, ".bvh") ) {
 
-				printf ("File %s\n", stat.m_filename);
+				printf ("File %s\n", name);
 
 				FileEntry file;
-				file.directory = getDirectory (stat.m_filename);
-				file.name 	   = getName (stat.m_filename);
-				file.archive   = f;
-				file.zipIndex  = i;
+				file.directory  = getDirectory (name);
+				file.name       = getName (name);
+				file.archive    = f;
+				file.archiveId  = archive;
+				file.tarId      = -1;
+				file.entryIndex = i;
 
 				app.files.push_back (file);
 			}
@@ -128,12 +236,53 @@ int addZip (const char* f) {
 		} else {
 
 			printf ("Failed to get file info from archive %s\n", f);
-			mz_zip_reader_end (&zipFile);
 			return -1;
 		}
 	}
 
-	mz_zip_reader_end (&zipFile);
+	return 0;
+}
+
+std::string indexPath (const char* archive) {	/** Where a tar archive's index is kept, next to it unless caches have a directory */
+
+	if (app.cacheDir.empty()) return std::string (archive) + ".index";
+
+	char hash[20];
+
+	snprintf (hash, sizeof (hash), "-%016llx", (unsigned long long) BVH::hash (archive, strlen (archive)));
+
+	return app.cacheDir + "/" + getName (archive) + hash + ".index";
+}
+
+int addTar (const char* f) {
+
+	int archive = app.tars.open (f, indexPath (f));	// Indexed on the first open only
+	std::vector<TarPool::Entry> entries;
+
+	if (!app.tars.entries (archive, entries)) {
+
+		printf ("Failed to open tar file %s\n", f);
+		return -1;
+	}
+
+	for (size_t i=0; i<entries.size(); ++i) {
+
+		if (endsWith (entries[i].name.c_str(), ".bvh")) {
+
+			printf ("File %s\n", entries[i].name.c_str());
+
+			FileEntry file;
+			file.directory  = getDirectory (entries[i].name.c_str());
+			file.name       = getName (entries[i].name.c_str());
+			file.archive    = f;
+			file.archiveId  = -1;
+			file.tarId      = archive;
+			file.entryIndex = (int) i;
+
+			app.files.push_back (file);
+		}
+	}
+
 	return 0;
 }
 
@@ -153,7 +302,7 @@ void addDirectory (const char* dir, bool recursive) {
 			snprintf (buffer, 2048, "%s%s", dir, i->name);
 			addDirectory (buffer, true);
 
-		} else if (strcmp (i->name + i->ext, "bvh")==0) {
+		} else if (isClip (i->name)) {
 
 			snprintf (buffer, 2048, "%s/%s", dir, i->name);
 			addFile (buffer);
@@ -163,147 +312,826 @@ void addDirectory (const char* dir, bool recursive) {
 
 // -------------------------------------------------------------------------------------- //
 
-BVH* loadFile (const FileEntry& file) {
+void publish (const LoadRequest& r, BVH* bvh, View::State state, Snapshot* warm=0) {
 
-	printf ("loadFile: %s\n", file.name.c_str());
+	Completion c = { r.index, bvh, state, r.kind, warm };
+	app.completed.push (c);
+}
 
-	if (file.archive.empty()) {
+void recycle (Buffer* buffer) {
 
-		std::string filename = file.directory + "/" + file.name;
+	if (buffer && buffer->capacity() > spareBytes) Buffer().swap (*buffer);
 
-		FILE* fp = fopen (filename.c_str(), "r");
+	app.buffers.give (buffer);
+}
 
-		if (!fp) { printf ("Failed\n"); return 0; }
+void recycle (MappedFile* content) {
 
-		fseek (fp, 0, SEEK_END);
-		int len = ftell (fp);
+	if (content) content->close();
 
-		rewind (fp);
-		char* content = new char[len+1];
+	app.mappings.give (content);
+}
 
-		fread (content, 1, len, fp);
-		content[len] = 0;
-		fclose (fp);
+void recycle (BVH* bvh) {						/** Main thread or the parser, once no view shows it */
 
-		BVH* bvh = new BVH();		// Read bvh
+	if (bvh) bvh->reset (spareBytes);
 
-		int r = bvh->load (content);
+	app.spareClips.give (bvh);
+}
 
-		if (r) return bvh;
+std::string cachePath (const FileEntry& file) {
 
-		else {
-			printf ("Error loading %s\n", filename.c_str());
-			delete bvh;
-		}
+	if (!app.cache) return std::string();
+
+	if (app.cacheDir.empty()) {					// Next to the source, archives can not hold it
+
+		return file.archive.empty()? file.directory + "/" + file.name + ".bvhc": std::string();
+	}
+
+	std::string key = file.archive + ":" + file.directory + "/" + file.name;
+	char hash[20];
+
+	snprintf (hash, sizeof (hash), "-%016llx", (unsigned long long) BVH::hash (key.c_str(), key.size()));
+
+	return app.cacheDir + "/" + file.name + hash + ".bvhc";
+}
+
+BVH* openCache (const std::string& path, const BVH::Stamp& source, const char* data) {	/** Null unless it still matches the source */
+
+	if (path.empty()) return 0;
+
+	BVH::Stamp cached;
+	BVH* bvh = app.spareClips.take();
+
+	if (bvh->openCache (path.c_str(), cached) && cached.size == source.size) {
+
+		bool same = data? cached.mtime == source.mtime: cached.hash == source.hash;	// Archive entries come hashed. A loose file is not read when size and mtime match, so an edit within one mtime tick is missed
+
+		if (!same && data) same = cached.hash == BVH::hash (data, source.size);	// Touched, maybe not changed
+
+		if (same) return bvh;
+	}
+
+	recycle (bvh);
+	return 0;
+}
+
+void release (LoadRequest& r) {				/** Give back what a load carries between stages */
+
+	recycle (r.content);
+	recycle (r.data);
+
+	r.content = 0;
+	r.entry   = 0;
+	r.data    = 0;
+}
+
+void fail (LoadRequest& r) {					/** Give up at any stage, a cancelled load can be asked for again */
+
+	release (r);
+
+	if (r.view->cancelRequested()) {
+
+		printf ("Cancelled %s\n", r.file.name.c_str());
+		publish (r, 0, View::EMPTY);
+
+	} else publish (r, 0, View::INVALID);		// Replaces any skeleton already shown
+}
+
+void forward (WorkPool<LoadRequest>& stage, LoadRequest& r) {	/** Waits while the stage is full */
+
+	if (!stage.push (r)) release (r);			// Shutting down
+}
+
+BVH* parseFile (const char* data, size_t size, const LoadRequest& r) {
+
+	BVH* bvh = app.spareClips.take();			// Reuses a dropped clip's blocks when they fit
+
+	bvh->setCancel (r.view->cancelFlag());
+
+	if (!bvh->open (data, size)) {				// Hierarchy only
+
+		if (!bvh->cancelled()) printf ("Error loading %s\n", r.file.name.c_str());
+		recycle (bvh);
 		return 0;
-	
-	} else {
+	}
 
-		bool result = false;
-		mz_zip_archive zipFile;
-		memset (&zipFile, 0, sizeof (zipFile));
-		mz_bool status = mz_zip_reader_init_file (&zipFile, file.archive.c_str(), 0);
+	publish (r, bvh, View::LOADING);			// Show the bind pose while frames are parsed, the view owns it now
 
-		if (!status) return 0;
+	bool result = bvh->loadFrames (app.parseThreads);
 
-		BVH* bvh = 0;
-		size_t size;
-		void* p = mz_zip_reader_extract_to_heap (&zipFile, file.zipIndex, &size, 0);
+	bvh->releaseSource();
 
-		if (p) {
+	if (!result) {
 
-			((char*)p)[size-1] = 0;
+		if (!bvh->cancelled()) printf ("Error loading %s\n", r.file.name.c_str());
+		return 0;								// Whatever replaces it deletes the skeleton
+	}
 
-			bvh = new BVH();
+	return bvh;
+}
 
-			result = bvh->load ((const char*)p);
-			
-			if (!result) { delete bvh; bvh = 0; }
-			mz_free (p);
-		}
+bool touchPages (const char* data, size_t size, const LoadRequest& r) {	/** Fault a mapped range in so the parser never waits on the disk */
+
+	const size_t page = 4096;
+	const volatile char* p = data;
+
+	for (size_t i=0; i<size; i += page) {
+
+		(void) p[i];
+
+		if ((i & 0xfffff) == 0 && r.view->cancelRequested()) return false;
+	}
+
+	return true;
+}
+
+bool checkPages (const char* data, size_t size, const LoadRequest& r) {	/** Fault a stored entry in, checking its crc on the way */
+
+	const size_t chunk = 1 << 20;
+	mz_ulong crc = MZ_CRC32_INIT;
+
+	for (size_t i=0; i<size; i += chunk) {
+
+		if (r.view->cancelRequested()) return false;
+
+		crc = mz_crc32 (crc, (const mz_uint8*) data + i, std::min (chunk, size - i));
+	}
+
+	if (crc != r.stamp.hash) printf ("Error reading %s\n", r.file.name.c_str());
 
-		mz_zip_reader_end (&zipFile);
-		return bvh;
+	return crc == r.stamp.hash;
+}
+
+bool readFile (LoadRequest& r) {				/** Map the file and fault it in, or open its cache */
+
+	std::string filename = r.file.directory + "/" + r.file.name;
+	long long   mtime    = 0;
+
+	r.content = app.mappings.take();			// Parsed straight out of the page cache
+
+	if (!r.content->open (filename.c_str())) { printf ("Failed\n"); return false; }
+
+	getFileInfo (filename.c_str(), 0, &mtime);
+
+	r.stamp.size  = r.content->size();
+	r.stamp.mtime = mtime;
+	r.stamp.hash  = 0;							// Only hashed when the cache needs it
+
+	r.bvh = openCache (r.cache, r.stamp, r.content->data());
+
+	if (r.bvh) { r.cache.clear(); release (r); return true; }
+
+	r.streamed = endsWith (r.file.name.c_str(), ".gz");		// Never inflated whole
+
+	return touchPages (r.content->data(), r.content->size(), r);
+}
+
+bool readZipEntry (LoadRequest& r) {			/** Read an entry as stored in the archive, or open its cache */
+
+	mz_zip_archive zipFile;						// This thread's reader, addZip parsed the directory
+
+	if (!app.zips.reader (r.file.archiveId, zipFile)) return false;
+
+	mz_zip_archive_file_stat stat;
+	bool ok = mz_zip_reader_file_stat (&zipFile, r.file.entryIndex, &stat) && (stat.m_method == 0 || stat.m_method == MZ_DEFLATED);
+
+	if (ok) {
+
+		r.stamp.size  = stat.m_uncomp_size;
+		r.stamp.mtime = stat.m_time;
+		r.stamp.hash  = stat.m_crc32;
+
+		r.bvh = openCache (r.cache, r.stamp, 0);
+
+		if (r.bvh) { r.cache.clear(); return true; }
+
+		r.entry = app.zips.entry (r.file.archiveId, r.file.entryIndex, r.entrySize, r.deflated);	// Never copied out
+		ok      = r.entry && r.entrySize > 0;
+
+		if (ok && r.deflated) {					// Only read ahead, a later stage inflates it
+
+			r.streamed = stat.m_uncomp_size > streamBytes;
+			ok         = touchPages (r.entry, r.entrySize, r);
+
+		} else if (ok) ok = r.entrySize == stat.m_uncomp_size && checkPages (r.entry, r.entrySize, r);
 	}
+
+	return ok;
 }
 
-void requestLoad (const FileEntry& file, View* v) {
+bool readTarEntry (LoadRequest& r) {			/** Fault an entry's bytes in, or the deflated run holding it, or open its cache */
+
+	TarPool::Entry entry;
+
+	if (!app.tars.entry (r.file.tarId, r.file.entryIndex, entry)) return false;
+
+	r.stamp.size  = entry.size;
+	r.stamp.mtime = entry.mtime;
+	r.stamp.hash  = entry.header;				// No content checksum, the header tells entries apart
+
+	r.bvh = openCache (r.cache, r.stamp, 0);
 
-	MutexLock lock (app.loadMutex);
+	if (r.bvh) { r.cache.clear(); return true; }
+
+	if (app.tars.gzipped (r.file.tarId)) {		// Inflated by the parser from the checkpoint before it
+
+		size_t size;
+		const char* data = app.tars.deflated (r.file.tarId, r.file.entryIndex, size);
+
+		r.streamed = true;
+		return data && touchPages (data, size, r);
+	}
+
+	r.entry = app.tars.data (r.file.tarId, r.file.entryIndex, r.entrySize);	// In place, like stored zip entries
+
+	return r.entry && r.entrySize > 0 && touchPages (r.entry, r.entrySize, r);
+}
+
+void requestLoad (int index, float priority) {
 
 	LoadRequest r;
-	r.file = file;
-	r.view = v;
+	r.file  = app.files[index];
+	r.view  = app.views[index];
+	r.index = index;
+	r.kind  = app.warm[index]? PROMOTE: LOAD;	// A snapshot always belongs to the hierarchy the view still has
+	r.bvh   = app.views[index]->getBVH();
+	r.warm  = app.warm[index];
+	r.content  = 0;
+	r.entry    = 0;
+	r.entrySize = 0;
+	r.data     = 0;
+	r.deflated = false;
+	r.streamed = false;
+
+	if (r.warm) ++app.stats.warmHits;
+	else ++app.stats.misses;
+
+	r.view->setText (r.file.name.c_str() );
+	r.view->setState (View::QUEUED);			// Before a worker can pick it up
+	r.view->requestCancel (false);
+
+	app.loader.push (r, priority);
+}
 
-	app.loadQueue.push_back (r);
+void requestDemote (int index) {				/** Snapshot a loaded clip on a loader before unloading it */
 
-	v->setText (file.name.c_str() );
-	v->setState (View::QUEUED);
+	LoadRequest r;
+	r.file  = app.files[index];
+	r.view  = app.views[index];
+	r.index = index;
+	r.kind  = DEMOTE;
+	r.bvh   = app.views[index]->getBVH();
+	r.warm  = 0;
+	r.content  = 0;
+	r.entry    = 0;
+	r.entrySize = 0;
+	r.data     = 0;
+	r.deflated = false;
+	r.streamed = false;
+
+	app.demoting[index] = 1;
+	app.loader.push (r, queueDistance);			// After everything on screen
 }
 
+struct ForView {
+
+	View* view;									// Matches loads for view, or all if null
+
+	bool operator() (const LoadRequest& r) const { return r.kind != DEMOTE && (!view || r.view == view); }
+};
+
 void cancelLoad (View* v) {
 
-	MutexLock lock (app.loadMutex);
+	std::vector<LoadRequest> removed;
+	ForView match = { v };
+
+	app.loader.remove (match, removed);
+
+	for (size_t i=0; i<removed.size(); ++i) removed[i].view->setState( View::EMPTY );
+}
+
+void cancelAll() {
+
+	cancelLoad (0);
+}
+
+float loadPriority (int index) {				/** Screens away from being shown, lower loads first */
+
+	const float lookAhead = 4;					// Clips a screen ahead in single view
+	float ahead, behind;
+
+	if (app.mode == VIEW_SINGLE) {
 
-	for (size_t i=0; i<app.loadQueue.size(); ++i) {
+		int count = app.views.size();
+		int steps = ((index - app.activeIndex) * app.direction % count + count) % count;
+
+		ahead  = steps / lookAhead;
+		behind = steps? (count - steps) / lookAhead: 0;
+
+	} else {
 
-		if(app.loadQueue[i].view == v) {
+		const View* view = app.views[index];	// Gap between the tile and the window
+		float above = (float) (view->top() - app.height) / app.height;
+		float below = (float) -view->bottom() / app.height;
 
-			app.loadQueue.erase (app.loadQueue.begin()+i);
+		if (above <= 0 && below <= 0) return 0;
 
-			v->setState( View::EMPTY );
-			break;
+		ahead  = app.direction > 0? below: above;	// Later files are further down
+		behind = app.direction > 0? above: below;
+	}
+
+	if (ahead  < 0) ahead  = 1e9f;
+	if (behind < 0) behind = 1e9f;
+
+	return ahead < behind * 2? ahead: behind * 2;		// Whatever is behind the scroll counts double
+}
+
+struct ByPriority {
+
+	float operator() (const LoadRequest& r) const { return r.kind == DEMOTE? queueDistance: app.priority[r.index]; }
+};
+
+struct Beyond {
+
+	float distance;								// Matches loads no longer wanted
+
+	bool operator() (const LoadRequest& r) const { return r.kind != DEMOTE && app.priority[r.index] > distance; }
+};
+
+void account (int index) {						/** Recount the bytes held by a view */
+
+	size_t bytes = app.views[index]->memoryUsage();
+
+	app.memoryUsed    = app.memoryUsed - app.memory[index] + bytes;
+	app.memory[index] = bytes;
+}
+
+void unload (int index, bool keepSkeleton) {	/** Evict a view's clip, later loads get its allocations */
+
+	if (!keepSkeleton) recycle (app.views[index]->detachBVH());
+
+	app.views[index]->evict (keepSkeleton);
+}
+
+struct LeastRecent {
+
+	bool operator() (int a, int b) const { return app.lastSeen[a] < app.lastSeen[b]; }
+};
+
+void dropWarm (int index) {
+
+	if (!app.warm[index]) return;
+
+	app.warmUsed -= app.warm[index]->size();
+	delete app.warm[index];
+	app.warm[index] = 0;
+}
+
+void evictWarm() {								/** Drop the snapshots seen least recently until under the warm budget */
+
+	if (app.warmUsed <= app.warmBudget) return;
+
+	std::vector<int> candidates;				// Not while a PROMOTE may be reading it
+
+	for (size_t i=0; i<app.views.size(); ++i) {
+
+		View::State state = app.views[i]->getState();
+
+		if (app.warm[i] && state != View::QUEUED && state != View::LOADING) candidates.push_back (i);
+	}
+
+	std::sort (candidates.begin(), candidates.end(), LeastRecent());
+
+	size_t target = app.warmBudget / 10 * 9;
+
+	for (size_t i=0; i<candidates.size() && app.warmUsed > target; ++i) {
+
+		int k = candidates[i];
+
+		dropWarm (k);
+		++app.stats.warmEvictions;
+
+		if (app.views[k]->getState() == View::EMPTY && !app.keepSkeletons) {
+
+			recycle (app.views[k]->detachBVH());
+			account (k);
 		}
 	}
 }
 
-void cancelAll() {
+void evictClips() {								/** Unload the clips seen least recently until under the memory budget */
+
+	if (!app.memoryBudget || app.memoryUsed <= app.memoryBudget) return;
+
+	std::vector<int> candidates;				// Nothing on screen or about to be
+	size_t pending = 0;							// Being snapshot, about to be released
+
+	for (size_t i=0; i<app.views.size(); ++i) {
+
+		if (app.demoting[i]) pending += app.memory[i];
+
+		else if (app.views[i]->getState() == View::LOADED && app.priority[i] >= queueDistance) candidates.push_back (i);
+	}
+
+	std::sort (candidates.begin(), candidates.end(), LeastRecent());
+
+	size_t target = app.memoryBudget / 10 * 9;	// Some slack so this does not run every frame
+
+	for (size_t i=0; i<candidates.size() && app.memoryUsed > target + pending; ++i) {
+
+		int k = candidates[i];
+
+		if (!app.warmBudget) {					// Straight back to disk
+
+			unload (k, app.keepSkeletons);
+			account (k);
+
+		} else if (app.warm[k]) {				// Snapshot kept from before, unloading is free
 
-	MutexLock lock (app.loadMutex);
+			app.views[k]->evict (true);
+			account (k);
+			++app.stats.demotions;
 
-	for (size_t i=0; i<app.loadQueue.size(); ++i) {
+		} else {
 
-		app.loadQueue[i].view->setState( View::EMPTY );
+			requestDemote (k);
+			pending += app.memory[k];
+		}
 	}
+}
+
+void scheduleLoads() {							/** Queue views near the screen, demote ones moving away and drop far ones */
+
+	app.priority.resize (app.views.size());
+	app.lastSeen.resize (app.views.size(), 0);
+	app.memory.resize   (app.views.size(), 0);
+	app.warm.resize     (app.views.size(), 0);
+	app.demoting.resize (app.views.size(), 0);
+	++app.frame;
+
+	for (size_t i=0; i<app.views.size(); ++i) {
+
+		app.priority[i] = loadPriority (i);
+
+		if (app.priority[i] > 0) continue;
+
+		if (app.lastSeen[i] + 1 != app.frame && app.views[i]->getState() == View::LOADED) ++app.stats.hotHits;
+
+		app.lastSeen[i] = app.frame;
+	}
+
+	ByPriority rank;
+	app.loader.rank (rank);
+
+	std::vector<LoadRequest> removed;
+	Beyond far = { dropDistance };
+
+	app.loader.remove (far, removed);
 
-	app.loadQueue.clear();
+	for (size_t i=0; i<removed.size(); ++i) removed[i].view->setState (View::EMPTY);
+
+	for (size_t i=0; i<app.views.size(); ++i) {
+
+		View::State state = app.views[i]->getState();
+
+		if (state == View::EMPTY && app.priority[i] < queueDistance) requestLoad (i, app.priority[i]);
+
+		else if (state == View::LOADING && app.priority[i] > dropDistance) app.views[i]->requestCancel();
+	}
+
+	evictClips();
+	evictWarm();
 }
 
-void loadThreadFunc (bool* running) {
+void demoteJob (LoadRequest& next) {			// The clip is loaded, so the main thread only reads it too
 
-	printf ("Load thread started\n");
-	
-	while (*running) {
+	Snapshot* warm = new Snapshot();
 
-		LoadRequest next;
-		next.view = 0;
+	if (!next.bvh->saveMotion (*warm)) { delete warm; warm = 0; }
 
-		{										// Explicitly scope MutexLock to avoid segfault and performance issues
-			MutexLock lock (app.loadMutex);
+	publish (next, next.bvh, View::LOADED, warm);
+}
 
-			if (!app.loadQueue.empty()) {
+void readJob (LoadRequest& r) {				// Read stage, the only one the view's priority orders
 
-				next = app.loadQueue.front();
+	if (r.kind == DEMOTE) { forward (app.inflater, r); return; }
 
-				app.loadQueue.erase (app.loadQueue.begin());
-			}
+	r.view->setState (View::LOADING);
 
-			if (next.view) {
+	if (r.kind == PROMOTE) { forward (app.inflater, r); return; }	// Only the view's hierarchy is read meanwhile
 
-				next.view->setState (View::LOADING);
+	if (r.view->cancelRequested()) { fail (r); return; }
 
-				BVH* bvh = loadFile (next.file);
+	printf ("loadFile: %s\n", r.file.name.c_str());
 
-				next.view->setBVH   (bvh, next.file.name.c_str());
-				next.view->autoZoom ();
-				next.view->setState (bvh? View::LOADED: View::INVALID);
-			}
+	r.bvh   = 0;
+	r.cache = cachePath (r.file);
+
+	bool read = r.file.archive.empty()? readFile (r): r.file.tarId >= 0? readTarEntry (r): readZipEntry (r);
+
+	if (!read) { fail (r); return; }
+
+	if (r.bvh) {								// Cached, straight to the finish stage
+
+		publish (r, r.bvh, View::LOADING);
+		forward (app.finisher, r);
+
+	} else forward (r.deflated && !r.streamed? app.inflater: app.parser, r);
+}
+
+void inflateJob (LoadRequest& r) {				// Inflate stage
+
+	if (r.kind == DEMOTE) { demoteJob (r); return; }
+
+	if (r.kind == PROMOTE) {
+
+		if (r.bvh->restoreMotion (&(*r.warm)[0], r.warm->size())) {
+
+			r.bvh->computeRootPath();			// Released with the motion, as the finisher does it
+			publish (r, r.bvh, View::LOADED);
+
+		} else {									// Back to disk, ahead of everything queued
+
+			r.kind = LOAD;
+			r.warm = 0;
+			forward (app.loader, r);
 		}
 
-		Thread::sleep (10);
+		return;
+	}
+
+	if (r.view->cancelRequested()) { fail (r); return; }
+
+	Buffer* text = app.buffers.take();
+	size_t  size = (size_t) r.stamp.size;
+
+	text->resize (size);
+
+	size_t got = size? tinfl_decompress_mem_to_mem (&(*text)[0], size, r.entry, r.entrySize, 0): TINFL_DECOMPRESS_MEM_TO_MEM_FAILED;
+
+	r.entry    = 0;								// Raw deflate, no zlib header
+	r.data     = text;
+	r.deflated = false;
+
+	if (got != size || mz_crc32 (MZ_CRC32_INIT, (const mz_uint8*) &(*text)[0], size) != r.stamp.hash) {
+
+		printf ("Error inflating %s\n", r.file.name.c_str());
+		fail (r);
+		return;
+	}
+
+	forward (app.parser, r);
+}
+
+BVH* streamClip (const LoadRequest& r, BVH::ReadFunction read, void* source) {	/** Parse text as read inflates it, holding a window of it */
+
+	Buffer* window = app.buffers.take();
+
+	if (window->size() < streamWindow) window->resize (streamWindow);
+
+	BVH::Stream stream (read, source, *window);
+	BVH* bvh = app.spareClips.take();
+
+	bvh->setCancel (r.view->cancelFlag());
+
+	bool opened = bvh->openStream (stream);
+	bool ok     = opened;
+
+	if (opened) {
+
+		publish (r, bvh, View::LOADING);		// The view owns it now
+		ok = bvh->loadStream (stream);
+	}
+
+	while (ok && stream.fill()) stream.begin = stream.end;	// Rest of the source, so its crc is checked
+
+	recycle (window);
+
+	if (!ok && !bvh->cancelled()) printf ("Error loading %s\n", r.file.name.c_str());
+
+	if (!opened) recycle (bvh);
+
+	return ok? bvh: 0;							// Whatever replaces a published skeleton deletes it
+}
+
+size_t readEntry (void* entry, char* buffer, size_t size) {
+
+	return mz_zip_reader_extract_iter_read ((mz_zip_reader_extract_iter_state*) entry, buffer, size);
+}
+
+BVH* streamEntry (const LoadRequest& r) {		/** Inflate a zip entry straight into the parser */
+
+	mz_zip_archive zipFile;
+
+	if (!app.zips.reader (r.file.archiveId, zipFile)) return 0;
+
+	mz_zip_reader_extract_iter_state* entry = mz_zip_reader_extract_iter_new (&zipFile, r.file.entryIndex, 0);
+
+	if (!entry) return 0;
+
+	BVH* bvh    = streamClip (r, &readEntry, entry);
+	bool intact = mz_zip_reader_extract_iter_free (entry);
+
+	if (bvh && !intact) { printf ("Error inflating %s\n", r.file.name.c_str()); return 0; }
+
+	return bvh;
+}
+
+BVH* streamGzip (const LoadRequest& r) {		/** Inflate a mapped .gz file straight into the parser */
+
+	GzipReader* gzip = new GzipReader();		// Holds its dictionary, too big for the stack
+
+	BVH* bvh = 0;
+
+	if (!gzip->open (r.content->data(), r.content->size())) printf ("Error reading %s: not gzip\n", r.file.name.c_str());
+
+	else {
+
+		bvh = streamClip (r, &GzipReader::read, gzip);
+
+		if (bvh && !gzip->intact()) { printf ("Error inflating %s\n", r.file.name.c_str()); bvh = 0; }
+	}
+
+	delete gzip;
+	return bvh;
+}
+
+struct TarSource {								// Reads a gzipped tar entry, and nothing past it
+
+	GzipReader* gzip;
+	mz_uint64   left;
+};
+
+size_t readTarData (void* source, char* buffer, size_t size) {
+
+	TarSource* tar = (TarSource*) source;
+	size_t     got = tar->gzip->read (buffer, (size_t) std::min ((mz_uint64) size, tar->left));
+
+	tar->left -= got;
+	return got;
+}
+
+BVH* streamTarEntry (const LoadRequest& r) {	/** Inflate a .tar.gz entry into the parser, from the checkpoint before it */
+
+	TarSource source = { new GzipReader(), r.stamp.size };
+	BVH*      bvh    = 0;
+
+	if (!app.tars.seek (r.file.tarId, r.file.entryIndex, *source.gzip)) printf ("Error seeking to %s\n", r.file.name.c_str());
+
+	else {
+
+		bvh = streamClip (r, &readTarData, &source);
+
+		if (bvh && source.left) { printf ("Error inflating %s\n", r.file.name.c_str()); bvh = 0; }
+	}
+
+	delete source.gzip;
+	return bvh;
+}
+
+void parseJob (LoadRequest& r) {				// Parse stage, publishes the skeleton as soon as it is parsed
+
+	const char* data = r.content? r.content->data(): r.data? &(*r.data)[0]: r.entry;	// Stored entries straight from the archive
+	size_t      size = r.content? r.content->size(): r.data? r.data->size(): r.entrySize;
+
+	BVH* bvh = 0;
+
+	if (!r.view->cancelRequested()) {
+
+		if (!r.streamed) bvh = parseFile (data, size, r);
+		else if (r.content) bvh = streamGzip (r);	// Mapped .gz file
+		else if (r.file.tarId >= 0) bvh = streamTarEntry (r);
+		else bvh = streamEntry (r);				// Large zip entry
+	}
+
+	if (bvh && r.content && !r.cache.empty()) r.stamp.hash = BVH::hash (data, size);
+
+	release (r);
+
+	if (!bvh) { fail (r); return; }
+
+	r.bvh = bvh;
+	forward (app.finisher, r);
+}
+
+void finishJob (LoadRequest& r) {				// Finish stage, the view shows the skeleton meanwhile
+
+	BVH* bvh = r.bvh;
+
+	if (!r.cache.empty()) bvh->writeCache (r.cache.c_str(), r.stamp);
+
+	float rotationError, offsetError;
+
+	if (app.reduceAngle >= 0) {
+
+		float ratio = bvh->reduce (app.reduceAngle * 0.01745329f, app.reduceOffset, rotationError, offsetError);
+
+		printf ("Reduced %s to %.1f%% of keys: max error %.4f deg, %.5f units\n", r.file.name.c_str(), ratio * 100, rotationError * 57.29578f, offsetError);
+	}
+
+	if (app.compact && bvh->compact (rotationError, offsetError)) {
+
+		printf ("Compacted %s: max error %.4f deg, %.5f units\n", r.file.name.c_str(), rotationError * 57.29578f, offsetError);
 	}
 
-	printf ("Load thread ended\n");
+	bvh->computeRootPath();						// autoZoom on the main thread then only reads it
+
+	publish (r, bvh, View::LOADED);
+}
+
+void startLoaders() {							/** Later stages first, so nothing is pushed to a stopped one */
+
+	int cores = Thread::cores();
+
+	app.inflater.setCapacity (app.stageQueue? app.stageQueue: app.inflaters * 2);
+	app.parser.setCapacity   (app.stageQueue? app.stageQueue: app.parsers * 2);
+	app.finisher.setCapacity (app.stageQueue? app.stageQueue: app.finishers * 2);
+
+	app.parseThreads = cores / app.parsers;		// Share the cores between parsers
+	if (app.parseThreads < 1) app.parseThreads = 1;
+
+	int workers = app.readers + app.inflaters + app.parsers + app.finishers;
+
+	app.buffers.setLimit    (workers);			// Roughly what is in flight
+	app.mappings.setLimit   (workers);
+	app.spareClips.setLimit (app.parsers);
+
+	app.finisher.start (app.finishers, &finishJob, "finisher");
+	app.parser.start   (app.parsers, &parseJob, "parser");
+	app.inflater.start (app.inflaters, &inflateJob, "inflater");
+	app.loader.start   (app.readers, &readJob, "reader");
+}
+
+void stopLoaders() {							/** Earlier stages first, so none waits on a stopped one */
+
+	WorkPool<LoadRequest>* stages[] = { &app.loader, &app.inflater, &app.parser, &app.finisher };
+
+	for (int i=0; i<4; ++i) {
+
+		std::vector<LoadRequest> dropped;		// Whatever was queued, even by a later stage since
+
+		stages[i]->stop (&dropped);				// Lets jobs in progress finish, pushes to it fail from now on
+
+		for (size_t j=0; j<dropped.size(); ++j) release (dropped[j]);
+	}
+}
+
+void finishDemote (const Completion& c) {
+
+	View* view = app.views[c.index];
+
+	app.demoting[c.index] = 0;
+
+	if (!c.warm) {								// No snapshot, unload to disk instead
+
+		unload (c.index, app.keepSkeletons);
+		account (c.index);
+		return;
+	}
+
+	dropWarm (c.index);
+	app.warm[c.index] = c.warm;
+	app.warmUsed 	 += c.warm->size();
+
+	if (app.priority[c.index] >= queueDistance) {	// Else it came back, the snapshot makes unloading it later free
+
+		view->evict (true);
+		account (c.index);
+		++app.stats.demotions;
+	}
+}
+
+void applyCompletions (uint budget) {			/** Hand finished clips to their views, for up to budget ms */
+
+	uint start = SDL_GetTicks();
+	Completion c;
+
+	while (app.completed.pop (c)) {
+
+		View* view = app.views[c.index];
+
+		if (c.kind == DEMOTE) finishDemote (c);
+
+		else {
+
+			if (view->getBVH() != c.bvh) {		// New clip, any snapshot was of the old one
+
+				dropWarm (c.index);
+				recycle (view->detachBVH());
+				view->setBVH (c.bvh, app.files[c.index].name.c_str());
+			}
+
+			if (c.kind == PROMOTE) ++app.stats.promotions;
+
+			view->setState (c.state);
+			view->autoZoom ();
+
+			if (c.state != View::LOADING) account (c.index);	// A skeleton's motion is still being written
+		}
+
+		if (SDL_GetTicks() - start >= budget) break;	// Rest waits for the next frame
+	}
 }
 
 // -------------------------------------------------------------------------------------- //
@@ -337,17 +1165,53 @@ bool exportFile (const FileEntry& file) {
 		delete [] content;
 		return fp;
 	
+	} else if (file.tarId >= 0) {
+
+		TarPool::Entry entry;
+		GzipReader*    gzip = 0;
+		size_t         size = 0;
+		const char*    data = 0;
+
+		if (!app.tars.entry (file.tarId, file.entryIndex, entry)) return false;
+
+		if (app.tars.gzipped (file.tarId)) {
+
+			gzip = new GzipReader();
+
+			if (!app.tars.seek (file.tarId, file.entryIndex, *gzip)) { delete gzip; return false; }
+
+		} else if (!(data = app.tars.data (file.tarId, file.entryIndex, size))) return false;
+
+		FILE* fp = fopen (outFile, "wb");
+		bool  ok = fp != 0;
+
+		if (ok && data) ok = fwrite (data, 1, size, fp) == size;
+
+		if (ok && gzip) {
+
+			std::vector<char> buffer (1 << 16);
+
+			for (mz_uint64 left = entry.size; ok && left; ) {
+
+				size_t n = gzip->read (&buffer[0], (size_t) std::min ((mz_uint64) buffer.size(), left));
+
+				ok    = n > 0 && fwrite (&buffer[0], 1, n, fp) == n;
+				left -= n;
+			}
+		}
+
+		if (fp) ok = fclose (fp) == 0 && ok;
+
+		delete gzip;
+		return ok;
+
 	} else {
 
 		mz_zip_archive zipFile;
-		memset (&zipFile, 0, sizeof (zipFile));
-		mz_bool status = mz_zip_reader_init_file (&zipFile, file.archive.c_str(), 0);
 
-		if (!status) return false;
+		if (!app.zips.reader (file.archiveId, zipFile)) return false;
 
-		mz_zip_reader_extract_to_file (&zipFile, file.zipIndex, outFile, MZ_ZIP_FLAG_IGNORE_PATH);
-		mz_zip_reader_end (&zipFile);
-		return true;
+		return mz_zip_reader_extract_to_file (&zipFile, file.entryIndex, outFile, MZ_ZIP_FLAG_IGNORE_PATH);
 	}
 }
 
@@ -363,29 +1227,115 @@ int main (int argc, char* argv[]) {
 	if (argc == 1) {
 
 		printf(
-			"\nusage: bvh-browser {.bvh | .zip | directory/ (Note trailing slash!)}\n\n"
+			"\nusage: bvh-browser [options] {.bvh | .bvh.gz | .zip | .tar | .tar.gz | directory/ (Note trailing slash!)}\n"
+			"       bvh-browser --bench [frames] [.bvh ...]\n\n"
+			"  --cache            keep parsed clips as .bvhc files next to the source\n"
+			"  --cache-dir dir    keep parsed clips and tar indexes in dir (also caches archive entries)\n"
+			"  --compact          store loaded clips quantised, 12 bytes per joint per frame, not with --reduce\n"
+			"  --reduce deg units drop keyframes that interpolate within these tolerances\n"
+			"  --loaders n        parse n files at once (default: one per core)\n"
+			"  --readers n        read n files at once (default: 4)\n"
+			"  --inflaters n      inflate n zip entries or snapshots at once (default: a quarter of the cores)\n"
+			"  --finishers n      cache, reduce and compact n clips at once (default: half the cores)\n"
+			"  --queue n          clips waiting for each stage (default: twice its workers)\n"
+			"  --memory mb        unload clips least recently seen past this (default: 1024, 0: never)\n"
+			"  --keep-skeletons   unloaded clips keep showing their bind pose\n"
+			"  --warm mb          keep unloaded clips compressed in memory up to this (default: 256)\n\n"
 			"bvh-browser (c) Sam Gynn (http://sam.draknek.org)\n"
 			"Distributed under GPL\n\n");
 		
 		return 1;
 	}
 
+	if (strcmp (argv[1], "--bench") == 0) return runBenchmark (argc-2, argv+2);
+
 	app.activeIndex  = -1;
 	app.mode 		 = VIEW_SINGLE;
 	app.scrollOffset = 0;
+	app.direction 	 = 1;
+	app.cache 		 = false;
+	app.compact 	 = false;
+	app.reduceAngle  = -1;
+	app.reduceOffset = 0;
+	app.readers 	 = 4;
+	app.inflaters 	 = std::max (Thread::cores() / 4, 1);
+	app.parsers 	 = Thread::cores();
+	app.finishers 	 = std::max (Thread::cores() / 2, 1);
+	app.stageQueue 	 = 0;
+	app.frame 		 = 0;
+	app.memoryBudget = (size_t) 1024 << 20;
+	app.memoryUsed 	 = 0;
+	app.keepSkeletons = false;
+	app.warmBudget 	 = (size_t) 256 << 20;
+	app.warmUsed 	 = 0;
+	memset (&app.stats, 0, sizeof (app.stats));
+
+	std::vector<const char*> sources;									// Added once every option is known
 	
 	for (int i=1; i<argc; ++i) {										// Parse arguments
 
-		if (isDirectory (argv[i])) { addDirectory (argv[i], true); }	// Valid: .bvh, .zip or directory (with trailing '/')
+		if (strcmp (argv[i], "--cache") == 0) { app.cache = true; continue; }
+		if (strcmp (argv[i], "--compact") == 0) { app.compact = true; continue; }
+
+		if (strcmp (argv[i], "--reduce") == 0 && i+2 < argc) {
+
+			app.reduceAngle  = atof (argv[++i]);
+			app.reduceOffset = atof (argv[++i]);
+			continue;
+		}
+
+		if (strcmp (argv[i], "--loaders") == 0 && i+1 < argc)   { app.parsers   = workerCount (argv[++i]); continue; }
+		if (strcmp (argv[i], "--readers") == 0 && i+1 < argc)   { app.readers   = workerCount (argv[++i]); continue; }
+		if (strcmp (argv[i], "--inflaters") == 0 && i+1 < argc) { app.inflaters = workerCount (argv[++i]); continue; }
+		if (strcmp (argv[i], "--finishers") == 0 && i+1 < argc) { app.finishers = workerCount (argv[++i]); continue; }
+		if (strcmp (argv[i], "--queue") == 0 && i+1 < argc)     { app.stageQueue = workerCount (argv[++i]); continue; }
+
+		if (strcmp (argv[i], "--memory") == 0 && i+1 < argc) {
+
+			double mb = atof (argv[++i]);
+			app.memoryBudget = mb > 0? (size_t) (mb * 1048576): 0;
+			continue;
+		}
+
+		if (strcmp (argv[i], "--keep-skeletons") == 0) { app.keepSkeletons = true; continue; }
+
+		if (strcmp (argv[i], "--warm") == 0 && i+1 < argc) {
 
-		else if (endsWith (argv[i], ".zip")) { addZip (argv[i]); }
+			double mb = atof (argv[++i]);
+			app.warmBudget = mb > 0? (size_t) (mb * 1048576): 0;
+			continue;
+		}
+
+		if (strcmp (argv[i], "--cache-dir") == 0 && i+1 < argc) {		// Cache options
+
+			app.cache 	 = true;
+			app.cacheDir = argv[++i];
+			continue;
+		}
+
+		sources.push_back (argv[i]);
+	}
+
+	if (app.compact && app.reduceAngle >= 0) {							// Reduced clips keep keys, not tracks, to quantise
+
+		printf ("Ignoring --compact, reduced clips can not be compacted\n");
+		app.compact = false;
+	}
+
+	for (size_t i=0; i<sources.size(); ++i) {
+
+		if (isDirectory (sources[i])) { addDirectory (sources[i], true); }	// Valid: .bvh, .bvh.gz, .zip, .tar, .tar.gz or directory (with trailing '/')
+
+		else if (endsWith (sources[i], ".zip")) { addZip (sources[i]); }
+
+		else if (isTar (sources[i])) { addTar (sources[i]); }
 		
 		else {
 
-			std::string dir = getDirectory (argv[i]);
+			std::string dir = getDirectory (sources[i]);
 			addDirectory (dir.c_str(), false);
 
-			const char* name = getName (argv[i]);						// Initial index
+			const char* name = getName (sources[i]);						// Initial index
 
 			for (size_t j=0; j<app.files.size(); ++j) {
 
@@ -438,16 +1388,6 @@ int main (int argc, char* argv[]) {
 		app.activeView->resize (0, 0, app.width, app.height, false);
 		app.activeView->setVisible (true);
 
-		for (int i=0; i<4; ++i) {								// Load files
-
-			int k = (app.activeIndex + i) % app.views.size();
-
-			if (app.views[k]->getState() == View::EMPTY) {
-
-				requestLoad (app.files[k], app.views[k]);
-			}
-		}
-
 	} else {
 
 		setLayout (VIEW_TILES);
@@ -545,7 +1485,7 @@ void mainLoop() {
 	int keyMask    = 0;
 	int index 	   = 0;
 
-	app.loadThread.begin (&loadThreadFunc, &running);		// start load thread
+	startLoaders();
 
 	while (running) {
 
@@ -583,7 +1523,7 @@ void mainLoop() {
 
 			case SDL_DROPFILE:
 
-				if (endsWith (event.drop.file, ".bvh")) {
+				if (isClip (event.drop.file)) {
 
 					addFile 	(event.drop.file);
 					createViews	();
@@ -615,6 +1555,7 @@ void mainLoop() {
 					if (offset>0 && app.scrollOffset >=0) break;
 
 					app.scrollOffset += offset;
+					app.direction     = offset < 0? 1: -1;
 
 					for (size_t i=0; i<app.views.size(); ++i) {
 
@@ -675,15 +1616,7 @@ void mainLoop() {
 						app.activeView->setVisible (true);
 						app.activeView->resize (0,0,app.width,app.height, false);
 
-						for (int i=0; i<4; ++i) {								// Load files (with look ahead)
-
-							int k = (index + i) % count;
-
-							if (app.views[k]->getState() == View::EMPTY) {
-
-								requestLoad (app.files[k], app.views[k]);
-							}
-						}
+						app.direction = m;										// Look ahead the way we are going
 					}
 				}
 
@@ -734,6 +1667,9 @@ void mainLoop() {
 
 			int count = 0;
 
+			applyCompletions (4);						// Swap finished clips in between frames
+			scheduleLoads();							// Loads follow what is on screen
+
 			switch (app.mode) {
 
 			case VIEW_SINGLE:
@@ -755,10 +1691,6 @@ void mainLoop() {
 
 					if (view->top() > app.height) continue;
 					if (view->bottom() <= 0) break;
-					if (view->getState() == View::EMPTY) {
-
-						requestLoad (app.files[i], view);
-					}
 
 					view->update (time);
 				}
@@ -788,11 +1720,19 @@ void mainLoop() {
 
 			static char buffer[128];
 
-			sprintf (buffer, "%d %x\n", t, keyMask);
+			const CacheStats& stats = app.stats;
+
+			snprintf (buffer, sizeof (buffer), "%d %x  hot %u warm %u miss %u  up %u down %u",
+			          t, keyMask, stats.hotHits, stats.warmHits, stats.misses, stats.promotions, stats.demotions);
 
 			SDL_SetWindowTitle (app.window, buffer);
 
 			SDL_GL_SwapWindow (app.window);
 		}
 	}
+
+	stopLoaders();
+
+	printf ("Cache: %u hot hits, %u warm hits, %u misses, %u promotions, %u demotions, %u snapshots dropped\n",
+	        app.stats.hotHits, app.stats.warmHits, app.stats.misses, app.stats.promotions, app.stats.demotions, app.stats.warmEvictions);
 }
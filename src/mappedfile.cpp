@@ -0,0 +1,112 @@
+#include "mappedfile.h"
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef WIN32
+
+MappedFile::MappedFile() : m_data(0), m_size(0), m_file(0), m_mapping(0) {}
+
+#else
+
+MappedFile::MappedFile() : m_data(0), m_size(0) {}
+
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+#ifdef WIN32
+
+bool MappedFile::open (const char* path) {
+
+	close();
+
+	HANDLE file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx (file, &size) || size.QuadPart == 0) {	// Empty files can not be mapped
+
+		CloseHandle (file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA (file, 0, PAGE_READONLY, 0, 0, 0);
+	void*  view    = mapping? MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0): 0;
+
+	if (!view) {
+
+		if (mapping) CloseHandle (mapping);
+		CloseHandle (file);
+		return false;
+	}
+
+	m_file    = file;
+	m_mapping = mapping;
+	m_data    = (const char*) view;
+	m_size    = (size_t) size.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+
+	if (m_data)    UnmapViewOfFile (m_data);
+	if (m_mapping) CloseHandle ((HANDLE) m_mapping);
+	if (m_file)    CloseHandle ((HANDLE) m_file);
+
+	m_data    = 0;
+	m_size    = 0;
+	m_file    = 0;
+	m_mapping = 0;
+}
+
+#else
+
+bool MappedFile::open (const char* path) {
+
+	close();
+
+	int fd = ::open (path, O_RDONLY);
+
+	if (fd < 0) return false;
+
+	struct stat st;
+
+	if (fstat (fd, &st) != 0 || st.st_size == 0) {				// Empty files can not be mapped
+
+		::close (fd);
+		return false;
+	}
+
+	void* p = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	::close (fd);												// Mapping keeps its own reference
+
+	if (p == MAP_FAILED) return false;
+
+	madvise (p, st.st_size, MADV_SEQUENTIAL);					// Parsed front to back
+
+	m_data = (const char*) p;
+	m_size = st.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+
+	if (m_data) munmap ((void*) m_data, m_size);
+
+	m_data = 0;
+	m_size = 0;
+}
+
+#endif
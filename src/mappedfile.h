@@ -0,0 +1,36 @@
+#ifndef _MAPPEDFILE_
+#define _MAPPEDFILE_
+
+#include <cstddef>
+
+/** Read-only memory mapped view of a file */
+
+class MappedFile {
+
+	public:
+
+		MappedFile();
+		~MappedFile();
+
+		bool open (const char* path);							/** Map a whole file, returns false on failure */
+		void close();											/** Unmap the file */
+
+		const char* data() const	{ return m_data; }			/** Start of the mapping (not null terminated) */
+		size_t      size() const	{ return m_size; }			/** Length of the mapping in bytes */
+		bool        isOpen() const	{ return m_data != 0; }
+
+	private:
+
+		MappedFile (const MappedFile&);							// Not copyable
+		MappedFile& operator= (const MappedFile&);
+
+		const char* m_data;
+		size_t      m_size;
+
+		#ifdef WIN32
+		void*       m_file;
+		void*       m_mapping;
+		#endif
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _MPSCQUEUE_
+#define _MPSCQUEUE_
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+/** Lock free queue, any number of threads push and a single thread pops. Pushing is one atomic
+ *  exchange and never waits; a push still being linked in is seen on a later pop. Values from
+ *  one thread come out in the order they went in. */
+
+template<class T>
+class MPSCQueue {
+
+	public:
+
+		MPSCQueue() {
+
+			m_tail = new Node();								// Stub, the tail is always an already popped node
+			m_tail->next = 0;
+			m_head = m_tail;
+		}
+
+		~MPSCQueue() {
+
+			while (m_tail) {
+
+				Node* next = m_tail->next;
+				delete m_tail;
+				m_tail = next;
+			}
+		}
+
+		void push (const T& value) {							/** Any thread */
+
+			Node* node  = new Node();
+			node->value = value;
+			node->next  = 0;
+
+			Node* prev = exchange (&m_head, node);				// Claims the end, then links the old end to it
+			store (&prev->next, node);
+		}
+
+		bool pop (T& value) {									/** Consumer thread only */
+
+			Node* next = load (&m_tail->next);
+
+			if (!next) return false;
+
+			value       = next->value;
+			next->value = T();									// Next becomes the stub
+			delete m_tail;
+			m_tail      = next;
+			return true;
+		}
+
+	private:
+
+		struct Node {
+
+			Node* volatile next;
+			T              value;
+		};
+
+		#ifdef WIN32
+		static Node* exchange (Node* volatile* p, Node* v)	{ return (Node*) InterlockedExchangePointer ((PVOID volatile*) p, v); }
+		static void  store (Node* volatile* p, Node* v)		{ MemoryBarrier(); *p = v; }
+		static Node* load (Node* volatile* p)				{ Node* v = *p; MemoryBarrier(); return v; }
+		#else
+		static Node* exchange (Node* volatile* p, Node* v)	{ return __atomic_exchange_n (p, v, __ATOMIC_ACQ_REL); }
+		static void  store (Node* volatile* p, Node* v)		{ __atomic_store_n (p, v, __ATOMIC_RELEASE); }
+		static Node* load (Node* volatile* p)				{ return __atomic_load_n (p, __ATOMIC_ACQUIRE); }
+		#endif
+
+		MPSCQueue (const MPSCQueue&);							// Not copyable
+		MPSCQueue& operator= (const MPSCQueue&);
+
+		Node* volatile m_head;									// Last pushed, producers only
+		Node*          m_tail;									// Stub ahead of the oldest value, consumer only
+};
+
+#endif
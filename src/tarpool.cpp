@@ -0,0 +1,542 @@
+#include "tarpool.h"
+#include "mappedfile.h"
+#include "directory.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <algorithm>
+
+/* Tar index (.index)
+ *
+ *   IndexHeader
+ *   IndexEntry[entryCount]
+ *   names          null terminated, referenced by IndexEntry::name
+ *   GzipReader::Checkpoint[checkpointCount], 16 byte aligned
+ *
+ * Stamped with the archive's size and mtime, and rebuilt when either changes. Checkpoints are the
+ * inflater's state as it is in memory, so an index written by another build or architecture fails
+ * the size or endian check and is rebuilt as well. */
+
+static const char      indexMagic[4]  = { 'B', 'V', 'H', 'T' };
+static const uint32_t  indexVersion   = 2;
+static const uint32_t  indexEndian    = 0x01020304;
+static const mz_uint64 checkpointSpan = 16 << 20;		// Inflated bytes between checkpoints, about 40k each
+
+struct IndexHeader {
+
+	char     magic[4];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t checkpointSize;
+	uint64_t sourceSize;
+	int64_t  sourceMtime;
+	uint32_t entryCount;
+	uint32_t checkpointCount;
+	uint64_t namesOffset;
+	uint64_t namesSize;
+	uint64_t checkpointsOffset;
+	uint64_t fileSize;
+};
+
+struct IndexEntry {
+
+	uint64_t offset;
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t name;								// Offset into names
+	uint32_t header;
+};
+
+static inline uint64_t align (uint64_t v, uint64_t a) { return (v + a - 1) & ~(a - 1); }
+
+// -------------------------------------------------------------------------------------- //
+
+struct TarStream {								// The tar bytes, straight from the mapping or inflated
+
+	const char*  data;
+	size_t       size;
+	GzipReader*  gzip;
+	mz_uint64    position;
+	mz_uint64    next;							// Checkpoint due here
+	std::vector<GzipReader::Checkpoint>* checkpoints;
+
+	void checkpoint() {
+
+		if (!gzip || position < next) return;
+
+		checkpoints->push_back (GzipReader::Checkpoint());
+		gzip->save (checkpoints->back());
+		next = position + checkpointSpan;
+	}
+
+	bool read (char* buffer, size_t n) {		// n bytes, false if the archive ends first
+
+		if (!gzip) {
+
+			if (n > size - position) return false;
+
+			memcpy (buffer, data + position, n);
+			position += n;
+			return true;
+		}
+
+		checkpoint();
+
+		size_t got = gzip->read (buffer, n);
+		position += got;
+		return got == n;
+	}
+
+	bool skip (mz_uint64 n) {
+
+		if (!gzip) {
+
+			if (n > size - position) return false;
+
+			position += n;
+			return true;
+		}
+
+		while (n) {								// Stopping at every checkpoint on the way
+
+			checkpoint();
+
+			mz_uint64 step = std::min (n, next - position);
+			mz_uint64 got  = gzip->skip (step);
+
+			position += got;
+			n        -= got;
+
+			if (got != step) return false;
+		}
+
+		return true;
+	}
+};
+
+static mz_uint64 number (const unsigned char* field, int length) {	// Octal, or base-256 with the top bit set
+
+	mz_uint64 v = 0;
+	int i = 0;
+
+	if (field[0] & 0x80) {
+
+		for (v = field[0] & 0x7f, i = 1; i < length; ++i) v = v << 8 | field[i];
+		return v;
+	}
+
+	while (i < length && field[i] == ' ') ++i;
+
+	for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) v = v * 8 + (field[i] - '0');
+
+	return v;
+}
+
+static std::string text (const unsigned char* field, size_t length) {
+
+	size_t n = 0;
+
+	while (n < length && field[n]) ++n;
+
+	return std::string ((const char*) field, n);
+}
+
+static void readPax (const std::string& pax, std::string& name, mz_uint64& size, bool& sized) {	// "length key=value\n" records
+
+	size_t i = 0;
+
+	while (i < pax.size()) {
+
+		size_t length = (size_t) atol (pax.c_str() + i);
+		size_t space  = pax.find (' ', i);
+
+		if (!length || space == std::string::npos || i + length > pax.size() || space + 1 >= i + length) break;
+
+		std::string record = pax.substr (space + 1, i + length - space - 2);	// Without the newline
+		size_t      equals = record.find ('=');
+
+		if (equals != std::string::npos) {
+
+			std::string key = record.substr (0, equals);
+
+			if (key == "path") name = record.substr (equals + 1);
+
+			else if (key == "size") {
+
+				size  = strtoull (record.c_str() + equals + 1, 0, 10);
+				sized = true;
+			}
+		}
+
+		i += length;
+	}
+}
+
+// -------------------------------------------------------------------------------------- //
+
+int TarPool::open (const char* path, const std::string& index) {
+
+	base::MutexLock lock (m_lock);
+
+	for (size_t i=0; i<m_archives.size(); ++i) if (m_archives[i]->path == path) return (int) i;
+
+	Archive* archive = new Archive;
+	archive->path    = path;
+	archive->file    = new MappedFile();
+
+	long long mtime = 0;
+
+	getFileInfo (path, 0, &mtime);
+
+	bool ok = archive->file->open (path);
+
+	if (ok) {
+
+		const unsigned char* data = (const unsigned char*) archive->file->data();
+
+		archive->gzipped = archive->file->size() >= 2 && data[0] == 0x1f && data[1] == 0x8b;	// By content, .tgz or .tar.gz alike
+
+		if (!readIndex (archive, index, mtime)) {
+
+			printf ("Indexing %s\n", path);
+
+			bool complete = false;
+
+			ok = scan (archive, complete);
+
+			if (ok && !complete) printf ("Partially indexed %s, the index is not saved\n", path);	// Opened with the entries found
+
+			else if (ok && !index.empty() && !writeIndex (archive, index, mtime)) printf ("Could not save index %s\n", index.c_str());
+		}
+	}
+
+	if (!ok) {
+
+		delete archive->file;
+		delete archive;
+		return -1;
+	}
+
+	m_archives.push_back (archive);
+	return (int) m_archives.size() - 1;
+}
+
+bool TarPool::scan (Archive* archive, bool& complete) const {
+
+	complete = false;
+
+	TarStream stream;
+	stream.data        = archive->file->data();
+	stream.size        = archive->file->size();
+	stream.gzip        = 0;
+	stream.position    = 0;
+	stream.next        = 0;						// The first is at the start, before anything is read
+	stream.checkpoints = &archive->checkpoints;
+
+	if (archive->gzipped) {
+
+		stream.gzip = new GzipReader();
+
+		if (!stream.gzip->open (stream.data, stream.size)) { delete stream.gzip; return false; }
+	}
+
+	unsigned char block[512];
+	std::string   longName;						// From a GNU or pax header, for the entry after it
+	mz_uint64     paxSize = 0;
+	bool          sized   = false;
+
+	while (stream.read ((char*) block, 512)) {
+
+		int sum = 0;							// Checksum field counted as spaces
+
+		for (int i=0; i<512; ++i) sum += i >= 148 && i < 156? ' ': block[i];
+
+		if (sum == 8 * ' ') { complete = true; break; }	// Zero block, the end
+
+		if ((mz_uint64) sum != number (block + 148, 8)) { printf ("TarPool: Bad header at %llu in %s\n", (unsigned long long) stream.position - 512, archive->path.c_str()); break; }
+
+		char      type   = block[156];
+		mz_uint64 size   = number (block + 124, 12);
+		mz_uint64 padded = (size + 511) & ~(mz_uint64) 511;
+
+		if (type == 'L' || type == 'x') {		// Long name or pax attributes of the next entry
+
+			if (size > (1 << 20)) break;
+
+			std::string extra ((size_t) padded, 0);
+
+			if (!stream.read (&extra[0], (size_t) padded)) break;
+
+			extra.resize ((size_t) size);
+
+			if (type == 'L') longName = extra.c_str();
+			else readPax (extra, longName, paxSize, sized);
+			continue;
+		}
+
+		if (sized) {
+
+			size   = paxSize;
+			padded = (size + 511) & ~(mz_uint64) 511;
+		}
+
+		if (type == '0' || type == 0 || type == '7') {		// Regular files
+
+			Entry entry;
+			entry.name   = longName;
+			entry.offset = stream.position;
+			entry.size   = size;
+			entry.mtime  = (long long) number (block + 136, 12);
+			entry.header = (mz_uint32) mz_crc32 (MZ_CRC32_INIT, block, 512);
+
+			if (entry.name.empty()) {
+
+				entry.name = text (block, 100);
+
+				if (memcmp (block + 257, "ustar\0", 6) == 0 && block[345]) entry.name = text (block + 345, 155) + "/" + entry.name;
+			}
+
+			archive->entries.push_back (entry);
+		}
+
+		longName.clear();
+		sized = false;
+
+		if (!stream.skip (padded)) {			// Cut short, drop an entry that did not fit
+
+			if (!archive->entries.empty() && archive->entries.back().offset + archive->entries.back().size > stream.position) archive->entries.pop_back();
+			break;
+		}
+	}
+
+	delete stream.gzip;
+	return true;
+}
+
+bool TarPool::readIndex (Archive* archive, const std::string& index, long long mtime) const {
+
+	if (index.empty()) return false;
+
+	MappedFile file;
+
+	if (!file.open (index.c_str()) || file.size() < sizeof (IndexHeader)) return false;
+
+	const char*        base   = file.data();
+	const IndexHeader& header = *(const IndexHeader*) base;
+
+	bool valid = memcmp (header.magic, indexMagic, 4) == 0 &&
+	             header.version           == indexVersion &&
+	             header.endian            == indexEndian &&
+	             header.checkpointSize    == sizeof (GzipReader::Checkpoint) &&
+	             header.sourceSize        == archive->file->size() &&
+	             header.sourceMtime       == mtime &&
+	             header.fileSize          == file.size() &&
+	             header.namesOffset       == sizeof (IndexHeader) + (uint64_t) header.entryCount * sizeof (IndexEntry) &&
+	             header.checkpointsOffset >= header.namesOffset + header.namesSize &&
+	             header.checkpointsOffset + (uint64_t) header.checkpointCount * sizeof (GzipReader::Checkpoint) <= header.fileSize &&
+	             (header.checkpointCount > 0) == archive->gzipped;
+
+	if (!valid) return false;
+
+	const IndexEntry* entries = (const IndexEntry*) (base + sizeof (IndexHeader));
+	const char*       names   = base + header.namesOffset;
+
+	archive->entries.resize (header.entryCount);
+
+	for (uint32_t i=0; i<header.entryCount; ++i) {
+
+		const IndexEntry& e = entries[i];
+
+		if (e.name >= header.namesSize || !memchr (names + e.name, 0, header.namesSize - e.name) || (!archive->gzipped && e.offset + e.size > header.sourceSize)) {
+
+			archive->entries.clear();
+			return false;
+		}
+
+		archive->entries[i].name   = names + e.name;
+		archive->entries[i].offset = e.offset;
+		archive->entries[i].size   = e.size;
+		archive->entries[i].mtime  = e.mtime;
+		archive->entries[i].header = e.header;
+	}
+
+	const GzipReader::Checkpoint* checkpoints = (const GzipReader::Checkpoint*) (base + header.checkpointsOffset);
+
+	archive->checkpoints.assign (checkpoints, checkpoints + header.checkpointCount);
+	return true;
+}
+
+bool TarPool::writeIndex (const Archive* archive, const std::string& index, long long mtime) const {
+
+	IndexHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, indexMagic, 4);
+
+	std::vector<IndexEntry> entries (archive->entries.size());
+	std::vector<char>       names;
+
+	for (size_t i=0; i<entries.size(); ++i) {
+
+		const Entry& e = archive->entries[i];
+
+		entries[i].offset = e.offset;
+		entries[i].size   = e.size;
+		entries[i].mtime  = e.mtime;
+		entries[i].name   = (uint32_t) names.size();
+		entries[i].header = e.header;
+
+		names.insert (names.end(), e.name.c_str(), e.name.c_str() + e.name.size() + 1);
+	}
+
+	header.version           = indexVersion;
+	header.endian            = indexEndian;
+	header.checkpointSize    = sizeof (GzipReader::Checkpoint);
+	header.sourceSize        = archive->file->size();
+	header.sourceMtime       = mtime;
+	header.entryCount        = (uint32_t) entries.size();
+	header.checkpointCount   = (uint32_t) archive->checkpoints.size();
+	header.namesOffset       = sizeof (IndexHeader) + entries.size() * sizeof (IndexEntry);
+	header.namesSize         = names.size();
+	header.checkpointsOffset = align (header.namesOffset + names.size(), 16);
+	header.fileSize          = header.checkpointsOffset + archive->checkpoints.size() * sizeof (GzipReader::Checkpoint);
+
+	std::string temp = index + ".tmp";			// Never leave a half written index behind
+
+	FILE* fp = fopen (temp.c_str(), "wb");
+
+	if (!fp) return false;
+
+	static const char zero[16] = { 0 };
+	size_t padding = header.checkpointsOffset - header.namesOffset - names.size();
+
+	bool ok = fwrite (&header, sizeof (header), 1, fp) == 1;
+
+	ok = ok && (entries.empty() || fwrite (&entries[0], sizeof (IndexEntry), entries.size(), fp) == entries.size());
+	ok = ok && (names.empty() || fwrite (&names[0], 1, names.size(), fp) == names.size());
+	ok = ok && fwrite (zero, 1, padding, fp) == padding;
+	ok = ok && (archive->checkpoints.empty() || fwrite (&archive->checkpoints[0], sizeof (GzipReader::Checkpoint), archive->checkpoints.size(), fp) == archive->checkpoints.size());
+	ok = fclose (fp) == 0 && ok;
+
+	#ifdef WIN32
+	if (ok) remove (index.c_str());				// rename does not replace on windows
+	#endif
+
+	if (!ok || rename (temp.c_str(), index.c_str()) != 0) {
+
+		remove (temp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// -------------------------------------------------------------------------------------- //
+
+const TarPool::Archive* TarPool::get (int archive) const {
+
+	base::MutexLock lock (m_lock);
+
+	return archive >= 0 && archive < (int) m_archives.size()? m_archives[archive]: 0;
+}
+
+bool TarPool::entries (int archive, std::vector<Entry>& out) const {
+
+	const Archive* a = get (archive);
+
+	if (a) out = a->entries;
+
+	return a != 0;
+}
+
+bool TarPool::entry (int archive, int index, Entry& out) const {
+
+	const Archive* a = get (archive);
+
+	if (!a || index < 0 || index >= (int) a->entries.size()) return false;
+
+	out = a->entries[index];
+	return true;
+}
+
+bool TarPool::gzipped (int archive) const {
+
+	const Archive* a = get (archive);
+
+	return a && a->gzipped;
+}
+
+const char* TarPool::data (int archive, int index, size_t& size) const {
+
+	const Archive* a = get (archive);
+
+	size = 0;
+
+	if (!a || a->gzipped || index < 0 || index >= (int) a->entries.size()) return 0;
+
+	const Entry& e = a->entries[index];
+
+	if (e.offset + e.size > a->file->size()) return 0;
+
+	size = (size_t) e.size;
+	return a->file->data() + e.offset;
+}
+
+size_t TarPool::checkpoint (const Archive* archive, mz_uint64 position) const {
+
+	size_t first = 0, last = archive->checkpoints.size();	// Bisect for the last one not past position
+
+	while (last - first > 1) {
+
+		size_t middle = (first + last) / 2;
+
+		if (archive->checkpoints[middle].out <= position) first = middle;
+		else last = middle;
+	}
+
+	return first;
+}
+
+const char* TarPool::deflated (int archive, int index, size_t& size) const {
+
+	const Archive* a = get (archive);
+
+	size = 0;
+
+	if (!a || !a->gzipped || index < 0 || index >= (int) a->entries.size()) return 0;
+
+	const Entry& e = a->entries[index];
+
+	size_t first = checkpoint (a, e.offset);
+	size_t last  = checkpoint (a, e.offset + e.size);
+	size_t start = (size_t) a->checkpoints[first].in;
+	size_t end   = last + 1 < a->checkpoints.size()? (size_t) a->checkpoints[last + 1].in: a->file->size();
+
+	size = end > start? end - start: 0;
+	return a->file->data() + start;
+}
+
+bool TarPool::seek (int archive, int index, GzipReader& reader) const {
+
+	const Archive* a = get (archive);
+
+	if (!a || !a->gzipped || index < 0 || index >= (int) a->entries.size()) return false;
+
+	const Entry&                  e = a->entries[index];
+	const GzipReader::Checkpoint& c = a->checkpoints[checkpoint (a, e.offset)];
+
+	return reader.open (a->file->data(), a->file->size()) && reader.restore (c) && reader.skip (e.offset - c.out) == e.offset - c.out;
+}
+
+void TarPool::close() {
+
+	base::MutexLock lock (m_lock);
+
+	for (size_t i=0; i<m_archives.size(); ++i) {
+
+		delete m_archives[i]->file;
+		delete m_archives[i];
+	}
+
+	m_archives.clear();
+}
@@ -0,0 +1,68 @@
+#ifndef _TARPOOL_
+#define _TARPOOL_
+
+#include <vector>
+#include <string>
+#include "gzipreader.h"
+#include "thread.h"
+
+class MappedFile;
+
+/** Tar archives kept open for the session, plain or gzipped. The first open walks the archive for
+ *  its entries, for a .tar.gz keeping an inflate checkpoint every few megabytes on the way, and
+ *  saves both to an index file once it reaches the end; later opens read that instead. A damaged
+ *  or cut short archive opens with the entries before the damage, and is walked again next time.
+ *  A plain tar entry is read in place from the mapping, a gzipped one is inflated from the
+ *  checkpoint before it. Nothing changes once an archive is open, so any thread can read entries
+ *  at once. */
+
+class TarPool {
+
+	public:
+
+		struct Entry {
+
+			std::string name;									// Path inside the archive
+			mz_uint64   offset;									// Of the data, in the tar stream
+			mz_uint64   size;
+			long long   mtime;
+			mz_uint32   header;									// crc of the header block, tells entries apart
+		};
+
+		TarPool() {}
+		~TarPool() { close(); }
+
+		int  open (const char* path, const std::string& index);	/** Map an archive, read its index or build and save it; its id or -1 */
+		bool entries (int archive, std::vector<Entry>& out) const;	/** Regular files of an open archive */
+		bool entry (int archive, int index, Entry& out) const;
+		bool gzipped (int archive) const;
+		const char* data (int archive, int index, size_t& size) const;	/** A plain tar entry in the mapping, null if gzipped */
+		const char* deflated (int archive, int index, size_t& size) const;	/** Mapped range inflating a gzipped entry reads */
+		bool seek (int archive, int index, GzipReader& reader) const;	/** A reader at the start of a gzipped entry */
+		void close();											/** Every archive, once no reader is in use */
+
+	private:
+
+		struct Archive {
+
+			std::string    path;
+			MappedFile*    file;
+			bool           gzipped;
+			std::vector<Entry> entries;
+			std::vector<GzipReader::Checkpoint> checkpoints;	// Ascending, the first at the start
+		};
+
+		bool scan (Archive* archive, bool& complete) const;		// Entries up to the end, or up to damage if not complete
+		bool readIndex (Archive* archive, const std::string& index, long long mtime) const;
+		bool writeIndex (const Archive* archive, const std::string& index, long long mtime) const;
+		const Archive* get (int archive) const;
+		size_t checkpoint (const Archive* archive, mz_uint64 position) const;	// Last one at or before position
+
+		TarPool (const TarPool&);								// Not copyable
+		TarPool& operator= (const TarPool&);
+
+		mutable base::Mutex   m_lock;							// Guards the list, not the archives
+		std::vector<Archive*> m_archives;
+};
+
+#endif
@@ -23,6 +23,7 @@ namespace base {
 		Thread() : m_running(false), m_priority(0), m_thread(0) {};
 		~Thread() { 
 			if(m_running) printf("Warning: Thread still running\n");
+			join();
 		}
 
 		/** Begin a new thread
@@ -83,7 +84,17 @@ namespace base {
 		bool running() const { return m_running; }
 
 		/** Wait here until thread exits */
-		void join() const { while(m_running) sleep(10); }
+		void join() {
+			if(!m_thread) return;
+			#ifdef WIN32
+			WaitForSingleObject(m_thread, INFINITE);
+			CloseHandle(m_thread);
+			#endif
+			#ifdef LINUX
+			pthread_join(m_thread, 0);
+			#endif
+			m_thread = 0;
+		}
 		
 		/** set thread priority (WIN32 only) */
 		void priority(int p) {
@@ -100,10 +111,23 @@ namespace base {
 			#endif
 		}
 
+		/** Number of logical processors */
+		static int cores() {
+			#ifdef LINUX
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			return n > 0? n: 1;
+			#endif
+			#ifdef WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwNumberOfProcessors;
+			#endif
+		}
+
 		/** Tell current thread to sleep (milliseconds) */
 		static void sleep(int time) {
 			#ifdef LINUX
-			usleep(time);
+			usleep(time * 1000);
 			#endif
 			#ifdef WIN32
 			Sleep(time);
@@ -139,7 +163,9 @@ namespace base {
 		};
 
 		bool _beginThread(ThreadData* data) {
+			join();			// Reap a previous run that has finished
 			data->thread = this;
+			m_running = true;	// Set before the thread starts so join() can not miss it
 			#ifdef WIN32
 			m_thread = (HANDLE)_beginthreadex(0, 0, _threadFunc, data, 0, &m_threadID);
 			if(m_priority) SetThreadPriority(m_thread, m_priority); //set thread priority
@@ -147,14 +173,15 @@ namespace base {
 			#ifdef LINUX
 			pthread_attr_init(&pattr);
 			pthread_attr_setscope(&pattr, PTHREAD_SCOPE_SYSTEM);
-			pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_DETACHED);
-			//usleep(1000);
-			pthread_create(&m_thread, &pattr, _threadFunc, data);
+			pthread_attr_setdetachstate(&pattr, PTHREAD_CREATE_JOINABLE);
+			if(pthread_create(&m_thread, &pattr, _threadFunc, data) != 0) m_thread = 0;
+			pthread_attr_destroy(&pattr);
 			#endif
 			
 			//thread creation failed
 			if(m_thread==0) {
 				printf("Failed to create thread\n");
+				m_running = false;
 				delete data;
 				return false;
 			}
@@ -164,25 +191,26 @@ namespace base {
 		#ifdef WIN32
 		static unsigned int __stdcall _threadFunc(void* data) {
 			ThreadData* d = static_cast<ThreadData*>(data);
-			d->thread->m_running = true;
+			Thread* thread = d->thread;
 			d->run();
-			d->thread->m_running = false;
 			delete d;
+			thread->m_running = false;
+			return 0;
 		}
 		#else
 		static void* _threadFunc(void* data) {
 			ThreadData* d = static_cast<ThreadData*>(data);
-			d->thread->m_running = true;
+			Thread* thread = d->thread;
 			d->run();
-			d->thread->m_running = false;
-			pthread_exit(0);
 			delete d;
+			thread->m_running = false;
+			pthread_exit(0);
 		}
 		#endif
 
 
 		private:
-		bool m_running;			//thread status
+		volatile bool m_running;	//thread status
 		int m_priority;			//thread priority
 		
 		#ifdef WIN32
@@ -203,8 +231,20 @@ namespace base {
 		void unlock() { LeaveCriticalSection(&m_lock); }
 		bool tryLock(){ return TryEnterCriticalSection(&m_lock); }
 		private:
+		friend class Condition;
 		CRITICAL_SECTION m_lock;
 	};
+
+	/** Condition variable. Waiting releases the locked mutex until woken */
+	class Condition {
+		public:
+		Condition()          { InitializeConditionVariable(&m_cond); }
+		void wait(Mutex& m)  { SleepConditionVariableCS(&m_cond, &m.m_lock, INFINITE); }
+		void notify()        { WakeConditionVariable(&m_cond); }
+		void notifyAll()     { WakeAllConditionVariable(&m_cond); }
+		private:
+		CONDITION_VARIABLE m_cond;
+	};
 	#else 
 	class Mutex {
 		public:
@@ -212,10 +252,23 @@ namespace base {
 		~Mutex()      { pthread_mutex_destroy(&m_lock); }
 		void lock()   { pthread_mutex_lock(&m_lock); }
 		void unlock() { pthread_mutex_unlock(&m_lock); }
-		bool tryLock(){ return pthread_mutex_lock(&m_lock)==0; }
+		bool tryLock(){ return pthread_mutex_trylock(&m_lock)==0; }
 		private:
+		friend class Condition;
 		pthread_mutex_t m_lock;
 	};
+
+	/** Condition variable. Waiting releases the locked mutex until woken */
+	class Condition {
+		public:
+		Condition()          { pthread_cond_init(&m_cond, 0); }
+		~Condition()         { pthread_cond_destroy(&m_cond); }
+		void wait(Mutex& m)  { pthread_cond_wait(&m_cond, &m.m_lock); }
+		void notify()        { pthread_cond_signal(&m_cond); }
+		void notifyAll()     { pthread_cond_broadcast(&m_cond); }
+		private:
+		pthread_cond_t m_cond;
+	};
 	#endif
 	
 	/** Exception safe mutex aquistion class */
@@ -234,6 +287,15 @@ namespace base {
 		bool m_locked;
 	};
 
+	/** Flag shared between threads: a load sees what was written before the store it reads from */
+	#ifdef WIN32
+	template<class T> inline T    loadAcquire (const T* p)    { T v = *(const volatile T*) p; MemoryBarrier(); return v; }
+	template<class T> inline void storeRelease (T* p, T v)    { MemoryBarrier(); *(volatile T*) p = v; }
+	#else
+	template<class T> inline T    loadAcquire (const T* p)    { return __atomic_load_n (p, __ATOMIC_ACQUIRE); }
+	template<class T> inline void storeRelease (T* p, T v)    { __atomic_store_n (p, v, __ATOMIC_RELEASE); }
+	#endif
+
 };
 
 #endif
@@ -8,7 +8,7 @@
 
 View::View (int x, int y, int w, int h) : m_x(x), m_y(y), m_width(w), m_height(h), 
 										  m_tx(x), m_ty(y), m_twidth(w), m_theight(h),
-										  m_visible(false), m_paused(false), m_state(EMPTY),
+										  m_visible(false), m_paused(false), m_state(EMPTY), m_cancel(false),
 										  m_text(0), m_bvh(0), m_name(0) {
 	m_near 	= 0.1f;
 	m_far 	= 1000.f;
@@ -21,16 +21,26 @@ View::View (int x, int y, int w, int h) : m_x(x), m_y(y), m_width(w), m_height(h
 
 View::~View() {}
 
-void View::setBVH (BVH* bvh, const char* name) {
+BVH* View::detachBVH() {
+
+	BVH* bvh = m_bvh;
 
 	if (m_bvh) {
 
-		delete m_bvh;
 		delete [] m_final;
+		delete [] m_cursor;
 		if (m_name) free (m_name);
 		m_name = 0;
+		m_bvh  = 0;
 	}
 
+	return bvh;
+}
+
+void View::setBVH (BVH* bvh, const char* name) {
+
+	delete detachBVH();
+
 	m_bvh 	= bvh;
 	m_frame = 0;
 
@@ -38,6 +48,7 @@ void View::setBVH (BVH* bvh, const char* name) {
 
 		m_name 	= strdup (name);
 		m_final = new BVH_Math::Transform[m_bvh->getPartCount()];
+		m_cursor = new int[m_bvh->getPartCount()]();
 		updateBones(0);
 	}
 }
@@ -78,6 +89,26 @@ void View::setText (const char* text) {
 	}
 }
 
+void View::evict (bool keepSkeleton) {
+
+	setState (EMPTY);
+
+	if (keepSkeleton && m_bvh) {							// Bind pose stays up until reloaded
+
+		m_bvh->releaseMotion();
+		m_frame = 0;
+		updateBones (0);
+
+	} else setBVH (0);
+}
+
+size_t View::memoryUsage() const {
+
+	if (!m_bvh) return 0;
+
+	return m_bvh->memoryUsage() + m_bvh->getPartCount() * (sizeof (BVH_Math::Transform) + sizeof (int));
+}
+
 void View::setVisible (bool v) { m_visible = v; }
 
 bool View::isVisible() const { return m_visible; }
@@ -187,9 +218,19 @@ void View::autoZoom() {
 		shift += zoomToFit (m_final[i].offset, dir, n, d);
 	}
 
-	for (int i=0; i<m_bvh->getFrames(); ++i) {
+	const std::vector<BVH_Math::vec3>& path = m_bvh->getRootPath();	// Worked out by the loader
+	const bool loaded = getState() == LOADED;
+
+	for (size_t i=0; loaded && i<path.size(); ++i) shift += zoomToFit (path[i], dir, n, d);
+
+	for (int i=0; loaded && path.empty() && i<m_bvh->getFrames(); ++i) {	// Only the skeleton until the loader is done
+
+		if (!m_bvh->hasFrame (i)) continue;
 
-		shift += zoomToFit (m_bvh->getPart(0)->motion[i].offset, dir, n, d);
+		BVH_Math::Transform root;
+		m_bvh->getTransform (m_bvh->getPart(0), i, root);
+
+		shift += zoomToFit (root.offset, dir, n, d);
 	}
 
 	if (shift == 0) m_camera = m_target - dir;
@@ -199,9 +240,9 @@ void View::autoZoom() {
 
 void View::togglePause() { m_paused = !m_paused; }
 
-void View::setState (State s) { m_state = s; }
+void View::setState (State s) { base::storeRelease (&m_state, s); }
 
-View::State View::getState() const { return m_state; }
+View::State View::getState() const { return base::loadAcquire (&m_state); }
 
 void View::update (float time) {
 
@@ -231,7 +272,7 @@ void View::update (float time) {
 		updateProjection();
 	}
 	
-	if (m_bvh && !m_paused && m_visible) {
+	if (m_bvh && getState() == LOADED && !m_paused && m_visible) {
 
 		m_frame += time / m_bvh->getFrameTime();
 
@@ -340,25 +381,32 @@ void View::updateBones (float frame) {
 	int f 	= floor (frame);
 	float t = frame - f;
 
-	if (f >= m_bvh->getFrames()-1) {
+	bool bindPose = getState() != LOADED;							// A loader may still be writing frames
+
+	if (!bindPose) {
+
+		if (f >= m_bvh->getFrames()-1) {
 
-		f = m_bvh->getFrames()-1;
-		t = 0.f;
+			f = m_bvh->getFrames()-1;
+			t = 0.f;
+		}
+
+		bindPose = !m_bvh->hasFrame (f);
+		if (!m_bvh->hasFrame (f+1)) t = 0.f;
 	}
 
-	BVH_Math::Transform local;
+	if (!bindPose) m_bvh->getPose (f + t, m_final, m_cursor);		// Local transforms, then concatenate in place
 
 	for (int i=0; i<m_bvh->getPartCount(); ++i) {
 
 		const BVH::Part* part = m_bvh->getPart(i);
 
-		if (t > 0) {
+		BVH_Math::Transform local = m_final[i];
 
-			local.offset = lerp (part->motion[f].offset, part->motion[f+1].offset, t);
-			local.rotation = BVH_Math::slerp (part->motion[f].rotation, part->motion[f+1].rotation, t);
+		if (bindPose) {
 
-		} else {
-			local = part->motion[f];
+			local.offset   = part->offset;
+			local.rotation = BVH_Math::Quaternion();
 		}
 
 		if (part->parent>=0) {
@@ -2,6 +2,7 @@
 #define _VIEW_
 
 #include "bvh.h"
+#include "thread.h"
 
 /** Single bvh view */
 
@@ -15,6 +16,11 @@ class View {
 		~View();
 
 		void setBVH 		(BVH*, const char* name=0);
+		const BVH* getBVH	() const		{ return m_bvh; }
+		BVH* getBVH			()				{ return m_bvh; }
+		BVH* detachBVH		();								// Hand the clip over undeleted, the view is left without one
+		void evict			(bool keepSkeleton);
+		size_t memoryUsage	() const;
 		void resize 		(int x, int y, int w, int h, bool smooth=false);
 		void move 			(int x, int y);
 		bool contains 		(int mx, int my);
@@ -37,6 +43,10 @@ class View {
 		State getState		() const;
 		void setState		(State);
 
+		void requestCancel	(bool c=true)	{ base::storeRelease (&m_cancel, c); }	// Ask a load in progress to stop
+		bool cancelRequested() const		{ return base::loadAcquire (&m_cancel); }
+		const bool* cancelFlag() const		{ return &m_cancel; }	// For BVH::setCancel
+
 		void setText 		(const char* text);
 		static void setFont (const char* font, int size=24);
 
@@ -48,7 +58,9 @@ class View {
 		char  m_title[128];
 		bool  m_visible;
 		bool  m_paused;
-		State m_state;
+
+		State m_state;						// Loaders move it to LOADING, any thread goes through getState
+		bool  m_cancel;						// Loaders poll it, through cancelRequested
 
 		unsigned   m_text;
 		int        m_textWidth;
@@ -63,6 +75,7 @@ class View {
 		float m_near, m_far;
 
 		BVH_Math::Transform* m_final;
+		int*                 m_cursor;			// Per part key cursor for reduced clips
 		BVH_Math::vec3  	 m_camera;
 		BVH_Math::vec3  	 m_target;
 
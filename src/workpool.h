@@ -0,0 +1,254 @@
+#ifndef _WORKPOOL_
+#define _WORKPOOL_
+
+#include <vector>
+#include <algorithm>
+#include "thread.h"
+
+/** Pool of worker threads running prioritised jobs from per worker heaps. New jobs are dealt out
+ *  in turn, each worker takes the most urgent job at the head of any heap, its own on a tie, and
+ *  equal priorities run oldest first. Priorities can be recomputed while jobs wait. Locks are only
+ *  held while a heap is changed, never while a job runs. Idle workers block until a job arrives.
+ *  With a capacity set, pushing waits while that many jobs are queued, so pools chained as stages
+ *  hold back the stage feeding them. */
+
+template<class Job>
+class WorkPool {
+
+	public:
+
+		typedef void (*Function) (Job& job);
+
+		WorkPool() : m_function(0), m_running(false), m_next(0), m_order(0), m_queued(0), m_capacity(0) {}
+		~WorkPool() { stop(); }
+
+		bool start (int workers, Function function, const char* name="loader") {	/** Start workers threads calling function */
+
+			if (m_running || workers < 1) return false;
+
+			m_function = function;
+			m_running  = true;
+
+			for (int i=0; i<workers; ++i) {
+
+				Worker* worker = new Worker;
+				worker->index  = i;
+				m_workers.push_back (worker);
+			}
+
+			for (int i=0; i<workers; ++i) {						// All heaps exist before anyone looks at them
+
+				m_workers[i]->thread.begin (this, &WorkPool::run, m_workers[i]);
+				m_workers[i]->thread.setName (name);
+			}
+
+			return true;
+		}
+
+		void stop (std::vector<Job>* dropped=0) {				/** Finish running jobs, drop queued ones or append them to dropped */
+
+			{
+				base::MutexLock lock (m_wakeLock);
+				m_running = false;
+				m_wake.notifyAll();
+				m_space.notifyAll();
+			}
+
+			{ base::MutexLock hold (m_pushLock); }				// A push already past the stop check has queued, later ones fail
+
+			for (size_t i=0; i<m_workers.size(); ++i) m_workers[i]->thread.join();
+
+			for (size_t i=0; i<m_workers.size(); ++i) {
+
+				for (size_t j=0; dropped && j<m_workers[i]->jobs.size(); ++j) dropped->push_back (m_workers[i]->jobs[j].job);
+
+				delete m_workers[i];
+			}
+
+			m_workers.clear();
+			m_queued = 0;
+		}
+
+		void setCapacity (int jobs) { m_capacity = jobs; }		/** Before start, 0 for no limit */
+
+		bool push (const Job& job, float priority=0) {			/** Lower priority runs first, false once stopped */
+
+			base::MutexLock hold (m_pushLock);					// Held until queued, so stop never deletes the worker picked
+
+			Entry   entry;
+			Worker* worker;
+
+			entry.job      = job;
+			entry.priority = priority;
+
+			{
+				base::MutexLock lock (m_wakeLock);				// Any thread may push, workers of an earlier stage too
+
+				while (m_running && m_capacity && m_queued >= m_capacity) m_space.wait (m_wakeLock);
+
+				if (!m_running) return false;					// Before m_workers is looked at, stop clears it
+
+				entry.order = m_order++;
+				worker      = m_workers[m_next++ % m_workers.size()];
+			}
+
+			{
+				base::MutexLock lock (worker->lock);
+				worker->jobs.push_back (entry);
+				std::push_heap (worker->jobs.begin(), worker->jobs.end(), Later());
+			}
+
+			base::MutexLock lock (m_wakeLock);					// Counted once it can be taken, so pushes racing
+			++m_queued;											// for the last slot may each get in
+			m_wake.notify();
+			return true;
+		}
+
+		/** Replace the priority of every queued job with rank (job) */
+		template<class Rank>
+		void rank (const Rank& rank) {
+
+			for (size_t i=0; i<m_workers.size(); ++i) {
+
+				base::MutexLock lock (m_workers[i]->lock);
+				std::vector<Entry>& jobs = m_workers[i]->jobs;
+
+				for (size_t j=0; j<jobs.size(); ++j) jobs[j].priority = rank (jobs[j].job);
+
+				std::make_heap (jobs.begin(), jobs.end(), Later());
+			}
+		}
+
+		/** Remove queued jobs for which match (job) is true, appending them to removed */
+		template<class Match>
+		int remove (const Match& match, std::vector<Job>& removed) {
+
+			int count = 0;
+
+			for (size_t i=0; i<m_workers.size(); ++i) {
+
+				base::MutexLock lock (m_workers[i]->lock);
+				std::vector<Entry>& jobs = m_workers[i]->jobs;
+				size_t kept = 0;
+
+				for (size_t j=0; j<jobs.size(); ++j) {
+
+					if (match (jobs[j].job)) {
+
+						removed.push_back (jobs[j].job);
+						++count;
+
+					} else jobs[kept++] = jobs[j];
+				}
+
+				jobs.resize (kept);
+				std::make_heap (jobs.begin(), jobs.end(), Later());
+			}
+
+			base::MutexLock lock (m_wakeLock);
+			m_queued -= count;
+			if (count) m_space.notifyAll();
+			return count;
+		}
+
+		int workers() const { return (int) m_workers.size(); }
+
+	private:
+
+		struct Entry {
+
+			Job      job;
+			float    priority;
+			unsigned order;										// Push order breaks ties
+		};
+
+		struct Later {											// Heap order, most urgent at the front
+
+			bool operator() (const Entry& a, const Entry& b) const {
+
+				return a.priority > b.priority || (a.priority == b.priority && a.order > b.order);
+			}
+		};
+
+		struct Worker {
+
+			base::Thread       thread;
+			base::Mutex        lock;							// Guards jobs only
+			std::vector<Entry> jobs;
+			int                index;
+		};
+
+		bool take (Worker* worker, Job& job) {
+
+			for (;;) {
+
+				Worker* best = 0;								// Compare heads one lock at a time
+				Entry   head;
+
+				for (size_t i=0; i<m_workers.size(); ++i) {		// Own heap first, others only when more urgent
+
+					Worker* other = m_workers[(worker->index + i) % m_workers.size()];
+
+					base::MutexLock lock (other->lock);
+
+					if (!other->jobs.empty() && (!best || Later() (head, other->jobs.front()))) {
+
+						best          = other;
+						head.priority = other->jobs.front().priority;
+						head.order    = other->jobs.front().order;
+					}
+				}
+
+				if (!best) return false;
+
+				base::MutexLock lock (best->lock);
+
+				if (best->jobs.empty()) continue;				// Taken in between, look again
+
+				std::pop_heap (best->jobs.begin(), best->jobs.end(), Later());
+				job = best->jobs.back().job;
+				best->jobs.pop_back();
+
+				base::MutexLock wake (m_wakeLock);				// May go below zero until the push counts it
+				--m_queued;
+				if (m_capacity) m_space.notify();
+				return true;
+			}
+		}
+
+		void run (Worker* worker) {
+
+			Job job;
+
+			while (waitForWork()) {
+
+				if (take (worker, job)) m_function (job);
+			}
+		}
+
+		bool waitForWork() {									// Blocks while nothing is queued, false once stopped
+
+			base::MutexLock lock (m_wakeLock);
+
+			while (m_running && m_queued <= 0) m_wake.wait (m_wakeLock);
+
+			return m_running;
+		}
+
+		WorkPool (const WorkPool&);								// Not copyable
+		WorkPool& operator= (const WorkPool&);
+
+		std::vector<Worker*> m_workers;
+		Function             m_function;
+		bool                 m_running;							// Changed under m_wakeLock once workers exist
+		unsigned             m_next;							// Round robin, under m_wakeLock
+		unsigned             m_order;							// Push count, likewise
+		base::Mutex          m_pushLock;						// Held by a push from the stop check until its job is queued
+		base::Mutex          m_wakeLock;						// Guards m_queued and the stop flag for waiters
+		base::Condition      m_wake;							// A job was queued
+		base::Condition      m_space;							// A job was taken, for pushes waiting on capacity
+		int                  m_queued;							// Jobs waiting in all heaps
+		int                  m_capacity;						// Queued jobs before push waits, 0 for no limit
+};
+
+#endif
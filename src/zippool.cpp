@@ -0,0 +1,93 @@
+#include "zippool.h"
+#include "mappedfile.h"
+#include <cstring>
+
+int ZipPool::open (const char* path) {
+
+	base::MutexLock lock (m_lock);
+
+	for (size_t i=0; i<m_archives.size(); ++i) if (m_archives[i]->path == path) return (int) i;
+
+	Archive* archive = new Archive;
+	archive->path    = path;
+	archive->file    = new MappedFile();
+
+	memset (&archive->zip, 0, sizeof (archive->zip));
+
+	if (!archive->file->open (path) || !mz_zip_reader_init_mem (&archive->zip, archive->file->data(), archive->file->size(), 0)) {
+
+		delete archive->file;
+		delete archive;
+		return -1;
+	}
+
+	m_archives.push_back (archive);
+	return (int) m_archives.size() - 1;
+}
+
+bool ZipPool::reader (int archive, mz_zip_archive& out) const {
+
+	base::MutexLock lock (m_lock);
+
+	if (archive < 0 || archive >= (int) m_archives.size()) return false;
+
+	out = m_archives[archive]->zip;								// Own error state, shared directory and mapping
+	return true;
+}
+
+const char* ZipPool::data (int archive, size_t& size) const {
+
+	base::MutexLock lock (m_lock);
+
+	if (archive < 0 || archive >= (int) m_archives.size()) { size = 0; return 0; }
+
+	size = m_archives[archive]->file->size();
+	return m_archives[archive]->file->data();
+}
+
+const char* ZipPool::entry (int archive, int index, size_t& size, bool& deflated) const {
+
+	const size_t localSize = 30;								// Fixed part of a local header, then name and extra field
+
+	mz_zip_archive zip;
+	mz_zip_archive_file_stat stat;
+	size_t mapped;
+
+	const unsigned char* file = (const unsigned char*) data (archive, mapped);
+
+	size = 0;
+
+	if (!file || !reader (archive, zip) || !mz_zip_reader_file_stat (&zip, index, &stat)) return 0;
+
+	if (stat.m_method != 0 && stat.m_method != MZ_DEFLATED) return 0;
+
+	size_t header = (size_t) stat.m_local_header_ofs;				// The local header has its own name and extra lengths
+
+	if (header > mapped || mapped - header < localSize) return 0;
+
+	const unsigned char* local = file + header;
+
+	if (local[0] != 'P' || local[1] != 'K' || local[2] != 3 || local[3] != 4) return 0;
+
+	size_t start = header + localSize + (local[26] | local[27] << 8) + (local[28] | local[29] << 8);
+
+	if (start > mapped || mapped - start < stat.m_comp_size) return 0;
+
+	size     = (size_t) stat.m_comp_size;
+	deflated = stat.m_method == MZ_DEFLATED;
+	return (const char*) file + start;
+}
+
+void ZipPool::close() {
+
+	base::MutexLock lock (m_lock);
+
+	for (size_t i=0; i<m_archives.size(); ++i) {
+
+		mz_zip_reader_end (&m_archives[i]->zip);
+		delete m_archives[i]->file;
+		delete m_archives[i];
+	}
+
+	m_archives.clear();
+}
@@ -0,0 +1,44 @@
+#ifndef _ZIPPOOL_
+#define _ZIPPOOL_
+
+#include <vector>
+#include <string>
+#include "miniz.h"
+#include "thread.h"
+
+class MappedFile;
+
+/** Zip archives kept open for the session. Each is mapped and its central directory parsed once.
+ *  Readers are copies of the archive's mz_zip_archive sharing that directory: reading entries out
+ *  of the mapping changes nothing they share, so each thread can have its own and read in parallel. */
+
+class ZipPool {
+
+	public:
+
+		ZipPool() {}
+		~ZipPool() { close(); }
+
+		int  open (const char* path);							/** Map and index an archive, its id or -1. An open one is not opened again */
+		bool reader (int archive, mz_zip_archive& out) const;	/** A reader of an open archive for the calling thread only */
+		const char* data (int archive, size_t& size) const;		/** The archive's mapping, null if not open */
+		const char* entry (int archive, int index, size_t& size, bool& deflated) const;	/** An entry's bytes as stored, in the mapping */
+		void close();											/** Every archive, once no reader is in use */
+
+	private:
+
+		struct Archive {
+
+			std::string    path;
+			MappedFile*    file;
+			mz_zip_archive zip;									// Never changed once open, readers are copies
+		};
+
+		ZipPool (const ZipPool&);								// Not copyable
+		ZipPool& operator= (const ZipPool&);
+
+		mutable base::Mutex   m_lock;							// Guards the list, not the archives
+		std::vector<Archive*> m_archives;
+};
+
+#endif